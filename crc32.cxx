@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <cstring>
+#include <atomic>
+#include "crc32.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC32_PCLMUL 1
+#endif
+
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#define CRC32_ARMV8 1
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+using namespace std;
+
+namespace {
+
+/*
+ * Slicing-by-8 tables, built by the compiler: t[0] is the classic byte
+ * table, t[k][b] is the crc of byte b followed by k zero bytes.
+ */
+struct CrcTables
+{
+	uint32_t t[8][256];
+
+	constexpr CrcTables()
+		: t()
+	{
+		for ( unsigned b = 0; b < 256; ++b )
+		{
+			uint32_t c = b;
+
+			for ( int k = 0; k < 8; ++k )
+				c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+
+			t[0][b] = c;
+		}
+
+		for ( unsigned b = 0; b < 256; ++b )
+			for ( int k = 1; k < 8; ++k )
+				t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+	}
+};
+
+constexpr CrcTables tables;
+
+/*
+ * Polynomials mod P(x) in the reflected representation the register uses:
+ * bit 31 is x**0 and bit 0 is x**31.
+ */
+constexpr uint32_t multModP(uint32_t a, uint32_t b)
+{
+	uint32_t p = 0;
+
+	for ( uint32_t m = 1u << 31; m; m >>= 1 )
+	{
+		if ( a & m )
+			p ^= b;
+
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+
+	return p;
+}
+
+// x**(2**k) mod P(x), k = 0..31
+struct X2nTable
+{
+	uint32_t t[32];
+
+	constexpr X2nTable()
+		: t()
+	{
+		uint32_t p = 1u << 30;	// x**1
+
+		for ( int k = 0; k < 32; ++k )
+		{
+			t[k] = p;
+			p = multModP(p, p);
+		}
+	}
+};
+
+constexpr X2nTable x2n;
+
+// x**(n * 2**k) mod P(x), one multiplication per set bit of n
+uint32_t x2nModP(size_t n, unsigned k)
+{
+	uint32_t p = 1u << 31;	// x**0
+
+	for ( ; n; n >>= 1, ++k )
+		if ( n & 1 )
+			p = multModP(x2n.t[k & 31], p);
+
+	return p;
+}
+
+// all engines work on the inverted crc register
+
+inline uint32_t crcBytes(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while ( len-- )
+		crc = tables.t[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+uint32_t crcSlice8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while ( len >= 8 )
+	{
+		uint32_t a = crc ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24);
+		uint32_t b = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t)buf[7] << 24;
+
+		crc = tables.t[7][a & 0xff] ^ tables.t[6][(a >> 8) & 0xff]
+			^ tables.t[5][(a >> 16) & 0xff] ^ tables.t[4][a >> 24]
+			^ tables.t[3][b & 0xff] ^ tables.t[2][(b >> 8) & 0xff]
+			^ tables.t[1][(b >> 16) & 0xff] ^ tables.t[0][b >> 24];
+
+		buf += 8;
+		len -= 8;
+	}
+
+	return crcBytes(crc, buf, len);
+}
+
+#ifdef CRC32_PCLMUL
+
+/*
+ * Carry-less multiplication folding, after Gopal et al., "Fast CRC
+ * Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+ * 2009).  Four 128 bit accumulators are folded 64 bytes at a time, merged,
+ * folded 16 bytes at a time and Barrett reduced to 32 bits.  The constants
+ * are x**n mod P(x), bit-reflected, for the CRC-32 polynomial.
+ */
+__attribute__((target("pclmul,sse4.1")))
+uint32_t crcPclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	if ( len < 64 )
+		return crcSlice8(crc, buf, len);
+
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, t1, t2, t3, t4;
+
+	x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf), _mm_cvtsi32_si128(crc));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 32));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 48));
+	buf += 64;
+	len -= 64;
+
+	while ( len >= 64 )
+	{
+		t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), _mm_loadu_si128((const __m128i *)buf));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, t2), _mm_loadu_si128((const __m128i *)(buf + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, t3), _mm_loadu_si128((const __m128i *)(buf + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, t4), _mm_loadu_si128((const __m128i *)(buf + 48)));
+		buf += 64;
+		len -= 64;
+	}
+
+	// four accumulators into one
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), x2);
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), x3);
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), x4);
+
+	while ( len >= 16 )
+	{
+		t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), _mm_loadu_si128((const __m128i *)buf));
+		buf += 16;
+		len -= 16;
+	}
+
+	// 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+	x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask32), poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return crcSlice8(_mm_extract_epi32(x1, 1), buf, len);
+}
+
+#endif // CRC32_PCLMUL
+
+#ifdef CRC32_ARMV8
+
+__attribute__((target("arch=armv8-a+crc")))
+uint32_t crcArmv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	while ( len && ((uintptr_t)buf & 7) )
+	{
+		crc = __crc32b(crc, *buf++);
+		--len;
+	}
+
+	while ( len >= 32 )
+	{
+		uint64_t v[4];
+		memcpy(v, buf, sizeof(v));
+		crc = __crc32d(crc, v[0]);
+		crc = __crc32d(crc, v[1]);
+		crc = __crc32d(crc, v[2]);
+		crc = __crc32d(crc, v[3]);
+		buf += 32;
+		len -= 32;
+	}
+
+	while ( len >= 8 )
+	{
+		uint64_t v;
+		memcpy(&v, buf, sizeof(v));
+		crc = __crc32d(crc, v);
+		buf += 8;
+		len -= 8;
+	}
+
+	while ( len-- )
+		crc = __crc32b(crc, *buf++);
+
+	return crc;
+}
+
+#endif // CRC32_ARMV8
+
+typedef uint32_t (*CrcFunc)(uint32_t crc, const uint8_t *buf, size_t len);
+
+struct Engine
+{
+	const char *name;
+	CrcFunc func;
+};
+
+// ordered by preference, the last supported one is the default
+const Engine engines[] = {
+	{ "slice8", crcSlice8 },
+#ifdef CRC32_PCLMUL
+	{ "pclmul", crcPclmul },
+#endif
+#ifdef CRC32_ARMV8
+	{ "armv8", crcArmv8 },
+#endif
+};
+
+const size_t engineCount = sizeof(engines) / sizeof(engines[0]);
+
+bool supported(const Engine &e)
+{
+#ifdef CRC32_PCLMUL
+	if ( e.func == crcPclmul )
+		return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+#ifdef CRC32_ARMV8
+	if ( e.func == crcArmv8 )
+		return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+	return true;
+}
+
+atomic<const Engine *> &engine()
+{
+	static atomic<const Engine *> e([] {
+		const Engine *best = &engines[0];
+
+		for ( size_t i = 0; i < engineCount; ++i )
+			if ( supported(engines[i]) )
+				best = &engines[i];
+
+		return best;
+	}());
+
+	return e;
+}
+
+}; // anonymous namespace
+
+uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+	return ~engine().load(memory_order_relaxed)->func(~crc, buf, len);
+}
+
+/*
+ * Feeding a zero byte into the register multiplies it by x**8 mod P(x), so
+ * 'len' zero bytes are one multiplication by x**(8*len) mod P(x), built from
+ * the x**(2**k) table like zlib's crc32_combine()
+ */
+uint32_t crc32Zeros(uint32_t crc, size_t len)
+{
+	return ~multModP(x2nModP(len, 3), ~crc);
+}
+
+const char *crc32Engine()
+{
+	return engine().load()->name;
+}
+
+bool setCrc32Engine(const char *name)
+{
+	for ( size_t i = 0; i < engineCount; ++i )
+	{
+		if ( strcmp(name, engines[i].name) == 0 && supported(engines[i]) )
+		{
+			engine().store(&engines[i]);
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32 as used by zlib and u-boot (reflected, polynomial 0xedb88320,
+ * initial value and final xor 0xffffffff): crc32(0, buf, len) is the crc
+ * of buf, passing a previous result continues it.
+ *
+ * The engine is chosen on first use: ARMv8 crc32 instructions (aarch64),
+ * PCLMULQDQ folding (x86) or slicing-by-8 tables.  All engines give
+ * identical results.
+ */
+uint32_t crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+// crc32(crc, zeros, len) for 'len' zero bytes, in O(log len) time
+uint32_t crc32Zeros(uint32_t crc, size_t len);
+
+// name of the engine in use: "slice8", "pclmul" or "armv8"
+const char *crc32Engine();
+
+// force an engine, returns false if this cpu doesn't support it
+bool setCrc32Engine(const char *name);
+
+#endif
@@ -0,0 +1,358 @@
+/* This program is an encoder/decoder for Reed-Solomon codes. Encoding is in
+   systematic form, decoding via the Berlekamp iterative algorithm.
+   In the present form , the constants mm, nn, tt, and kk=nn-2tt must be
+   specified  (the double letters are used simply to avoid clashes with
+   other n,k,t used in other programs into which this was incorporated!)
+   Also, the irreducible polynomial used to generate GF(2**mm) must also be
+   entered -- these can be found in Lin and Costello, and also Clark and Cain.
+
+   The representation of the elements of GF(2**m) is either in index form,
+   where the number is the power of the primitive element alpha, which is
+   convenient for multiplication (add the powers modulo 2**m-1) or in
+   polynomial form, where the bits represent the coefficients of the
+   polynomial representation of the number, which is the most convenient form
+   for addition.  The two forms are swapped between via lookup tables.
+   This leads to fairly messy looking expressions, but unfortunately, there
+   is no easy alternative when working with Galois arithmetic.
+
+   The code is not written in the most elegant way, but to the best
+   of my knowledge, (no absolute guarantees!), it works.
+   However, when including it into a simulation program, you may want to do
+   some conversion of global variables (used here because I am lazy!) to
+   local variables where appropriate, and passing parameters (eg array
+   addresses) to the functions  may be a sensible move to reduce the number
+   of global variables and thus decrease the chance of a bug being introduced.
+
+   This program does not handle erasures at present, but should not be hard
+   to adapt to do this, as it is just an adjustment to the Berlekamp-Massey
+   algorithm. It also does not attempt to decode past the BCH bound -- see
+   Blahut "Theory and practice of error control codes" for how to do this.
+
+              Simon Rockliff, University of Adelaide   21/9/89
+
+   26/6/91 Slight modifications to remove a compiler dependent bug which hadn't
+           previously surfaced. A few extra comments added for clarity.
+           Appears to all work fine, ready for posting to net!
+
+                  Notice
+                 --------
+   This program may be freely modified and/or given to whoever wants it.
+   A condition of such distribution is that the author's contribution be
+   acknowledged by his name being left in the comments heading the program,
+   however no responsibility is accepted for any financial or other loss which
+   may result from some unforseen errors or malfunctioning of the program
+   during use.
+                                 Simon Rockliff, 26th June 1991
+ */
+
+#include "ecc_rs.h"
+#include "ecc_rs_simd.h"
+#include "reed_solomon.h"
+#include <string.h>
+#include <atomic>
+
+/*
+ * RS code over GF(2**10), x**10 + x**3 + 1, correcting tt = 4 symbols.  The
+ * full code has nn = 1023 symbols, kk = 1015 of them information, and is
+ * shortened to the 512 data bytes actually stored.  All tables are built
+ * by the compiler, see galois.h and reed_solomon.h
+ */
+typedef GaloisField<10, 0x409> Gf1024;
+typedef ReedSolomon<Gf1024, 4, 512> Rs;
+
+#define tt 4
+#define npar (2 * tt)	/* parity symbols */
+#define ks 512		/* data bytes per block */
+
+#define RS_BATCH 16	/* blocks per syndrome kernel call */
+
+typedef Rs::Elem tgf;
+
+static_assert(npar == Rs::NK && npar == RS_SYN_COUNT && ks == RS_SYN_DATA,
+		"syndrome kernels don't match the code");
+
+static int syndromes_scalar(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count)
+{
+	(void)data; (void)acc; (void)count;
+	return 0;
+}
+
+/*
+ * A context is just the choice of syndrome kernel, everything else is
+ * constant.  The contexts are the entries of this table, ordered by
+ * preference, so they are immutable and never freed.
+ */
+struct rs_codec {
+	const char *name;
+	rs_syn_kernel kernel;
+};
+
+static const struct rs_codec codecs[] = {
+	{ "scalar", syndromes_scalar },
+#ifdef RS_SYN_X86
+	{ "sse2", rs_syn_sse2 },
+	{ "avx2", rs_syn_avx2 },
+#endif
+#ifdef RS_SYN_NEON
+	{ "neon", rs_syn_neon },
+#endif
+};
+
+#define NR_CODECS (int)(sizeof(codecs) / sizeof(codecs[0]))
+
+static int syn_kernel_supported(const char *name)
+{
+#ifdef RS_SYN_X86
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+#ifdef __i386__
+	if (strcmp(name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+#endif
+	return 1;
+}
+
+/* context used by the calls without one, the best kernel unless changed
+   by rs_set_syndrome_kernel() */
+static std::atomic<const struct rs_codec *> &default_codec(void)
+{
+	static std::atomic<const struct rs_codec *> codec(rs_codec_get(NULL));
+
+	return codec;
+}
+
+/* unpack the 10 byte ECC into the npar 10 bit parity symbols */
+static void unpack_ecc(const uint8_t *store_ecc, tgf par[npar])
+{
+	par[0] = ( (*(store_ecc+1) & (unsigned char)0x03) <<8) | (*(store_ecc));
+	par[1] = ( (*(store_ecc+2) & (unsigned char)0x0F) <<6) | (*(store_ecc+1)>>2);
+	par[2] = ( (*(store_ecc+3) & (unsigned char)0x3F) <<4) | (*(store_ecc+2)>>4);
+	par[3] = (*(store_ecc+4) <<2) | (*(store_ecc+3)>>6);
+
+	par[4] = ( (*(store_ecc+1+5) & 0x03) <<8) | (*(store_ecc+5));
+	par[5] = ( (*(store_ecc+2+5) & 0x0F) <<6) | (*(store_ecc+1+5)>>2);
+	par[6] = ( (*(store_ecc+3+5) & 0x3F) <<4) | (*(store_ecc+2+5)>>4);
+	par[7] = (*(store_ecc+4+5) <<2) | (*(store_ecc+3+5)>>6);
+}
+
+/* pack the npar 10 bit parity symbols into the 10 byte ECC */
+static void pack_ecc(const tgf bb[npar], uint8_t *ecc_code)
+{
+	*(ecc_code)	= (unsigned char) bb[0];
+	*(ecc_code+1)	= ((bb[0]) >> 8) | ((bb[1]) << 2);
+	*(ecc_code+2)	= ((bb[1]) >> 6) | ((bb[2]) << 4);
+	*(ecc_code+3)	= ((bb[2]) >> 4) | ((bb[3]) << 6);
+	*(ecc_code+4)	= ((bb[3]) >> 2);
+	*(ecc_code+5)	= (unsigned char) bb[4];
+	*(ecc_code+6)	= ((bb[4]) >> 8) | ((bb[5]) << 2);
+	*(ecc_code+7)	= ((bb[5]) >> 6) | ((bb[6]) << 4);
+	*(ecc_code+8)	= ((bb[6]) >> 4) | ((bb[7]) << 6);
+	*(ecc_code+9)	= ((bb[7]) >> 2);
+}
+
+/**
+ * calculate_ecc_rs - Calculate 10 byte Reed-Solomon ECC code for 512 byte block
+ * @dat:	raw data
+ * @ecc_code:	buffer for ECC
+ */
+extern int calculate_ecc_rs(const uint8_t *data, uint8_t *ecc_code)
+{
+	rs_encode_blocks(NULL, &data, &ecc_code, 1);
+	return 0;
+}
+
+/**
+ * correct_data_rs - Detect and correct bit error(s) using 10-byte Reed-Solomon ECC
+ * @dat:	raw data read from the chip
+ * @store_ecc:	ECC from the chip
+ * @calc_ecc:	the ECC calculated from raw data
+ */
+extern int correct_data_rs(uint8_t *data, uint8_t *store_ecc, uint8_t *calc_ecc)
+{
+	/* is decode needed ? */
+	if (	(*(uint16_t*)store_ecc       == *(uint16_t*)calc_ecc)       &&
+		(*(uint16_t*)(store_ecc + 2) == *(uint16_t*)(calc_ecc + 2)) &&
+		(*(uint16_t*)(store_ecc + 4) == *(uint16_t*)(calc_ecc + 4)) &&
+		(*(uint16_t*)(store_ecc + 6) == *(uint16_t*)(calc_ecc + 6)) &&
+		(*(uint16_t*)(store_ecc + 8) == *(uint16_t*)(calc_ecc + 8)))
+	{
+		return 0;
+	}
+
+	return (verify_data_rs(data, store_ecc) < 0) ? -1 : 0;
+}
+
+/*
+ * Error path of verify: at least one syndrome in syn[] (polynomial form)
+ * is non-zero
+ */
+static int correct_rs(uint8_t *data, const tgf syn[npar])
+{
+	int ret,i;
+
+	/* did we read an erased page ? */
+	for(i = 0; i < 512 ;i += 4)
+	{
+		if(*(uint32_t*)(data+i) != 0xFFFFFFFF)
+		{
+			goto correct;
+		}
+	}
+
+	/* page was erased, return gracefully */
+	return 0;
+
+
+correct:
+	ret = Rs::decode(data, syn);
+
+	/* Check for excessive errors */
+	if ((ret > tt) || (ret <= 0))
+		return -1;
+
+	return ret;
+}
+
+/**
+ * verify_data_rs - Check a 512 byte block against its stored 10-byte ECC
+ * @dat:	raw data read from the chip, corrected in place
+ * @store_ecc:	ECC from the chip
+ */
+extern int verify_data_rs(uint8_t *data, const uint8_t *store_ecc)
+{
+	int ret;
+
+	rs_verify_blocks(NULL, &data, &store_ecc, 1, &ret);
+	return ret;
+}
+
+/**
+ * verify_blocks_rs - verify_data_rs() for a number of blocks
+ * @data:	raw data of each block, corrected in place
+ * @store_ecc:	stored ECC of each block
+ * @count:	number of blocks
+ * @result:	verify_data_rs() result of each block, may be NULL
+ */
+extern int verify_blocks_rs(uint8_t *const *data, const uint8_t *const *store_ecc,
+		int count, int *result)
+{
+	return rs_verify_blocks(NULL, data, store_ecc, count, result);
+}
+
+/**
+ * rs_syndrome_kernel - Name of the syndrome kernel used by verify_blocks_rs
+ */
+extern const char *rs_syndrome_kernel(void)
+{
+	return rs_codec_kernel(NULL);
+}
+
+/**
+ * rs_set_syndrome_kernel - Force a syndrome kernel
+ * @name:	"scalar", "sse2", "avx2" or "neon"
+ */
+extern int rs_set_syndrome_kernel(const char *name)
+{
+	const struct rs_codec *codec = rs_codec_get(name);
+
+	if (!codec)
+		return -1;
+	default_codec().store(codec);
+	return 0;
+}
+
+/**
+ * rs_codec_get - Get an ECC context
+ * @kernel:	syndrome kernel name, NULL for the best one the cpu supports
+ */
+extern const struct rs_codec *rs_codec_get(const char *kernel)
+{
+	const struct rs_codec *best = NULL;
+	int i;
+
+	for (i = 0; i < NR_CODECS; i++) {
+		if (!syn_kernel_supported(codecs[i].name))
+			continue;
+		if (!kernel)
+			best = &codecs[i];
+		else if (strcmp(kernel, codecs[i].name) == 0)
+			return &codecs[i];
+	}
+	return best;
+}
+
+/**
+ * rs_codec_kernel - Name of the syndrome kernel of a context
+ * @codec:	context, NULL for the default
+ */
+extern const char *rs_codec_kernel(const struct rs_codec *codec)
+{
+	if (!codec)
+		codec = default_codec().load();
+	return codec->name;
+}
+
+/**
+ * rs_encode_blocks - calculate_ecc_rs() for a number of blocks
+ * @codec:	context, NULL for the default
+ * @data:	raw data of each block
+ * @ecc_code:	ECC buffer of each block
+ * @count:	number of blocks
+ */
+extern void rs_encode_blocks(const struct rs_codec *codec,
+		const uint8_t *const *data, uint8_t *const *ecc_code, int count)
+{
+	tgf bb[npar];
+	int b;
+
+	(void)codec;	/* the encoder has no kernel choice (yet) */
+	for (b = 0; b < count; b++) {
+		Rs::encode(data[b], bb);
+		pack_ecc(bb, ecc_code[b]);
+	}
+}
+
+/**
+ * rs_verify_blocks - verify_data_rs() for a number of blocks
+ * @codec:	context, NULL for the default
+ * @data:	raw data of each block, corrected in place
+ * @store_ecc:	stored ECC of each block
+ * @count:	number of blocks
+ * @result:	verify_data_rs() result of each block, may be NULL
+ */
+extern int rs_verify_blocks(const struct rs_codec *codec,
+		uint8_t *const *data, const uint8_t *const *store_ecc,
+		int count, int *result)
+{
+	int b, n, done, ret, failed = 0;
+	tgf par[RS_BATCH][npar];
+	tgf acc[RS_BATCH][npar];
+
+	if (!codec)
+		codec = default_codec().load();
+
+	for (; count > 0; count -= n, data += n, store_ecc += n) {
+		n = (count < RS_BATCH) ? count : RS_BATCH;
+
+		for (b = 0; b < n; b++) {
+			unpack_ecc(store_ecc[b], par[b]);
+			Rs::syndromesParity(par[b], acc[b]);
+		}
+
+		done = codec->kernel((const uint8_t *const *)data, acc, n);
+		for (b = done; b < n; b++)
+			Rs::syndromesData(data[b], acc[b]);
+
+		for (b = 0; b < n; b++) {
+			ret = Rs::nonZero(acc[b]) ? correct_rs(data[b], acc[b]) : 0;
+			if (ret < 0)
+				failed++;
+			if (result)
+				*result++ = ret;
+		}
+	}
+
+	return failed;
+}
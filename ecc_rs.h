@@ -28,6 +28,94 @@ extern int calculate_ecc_rs(const uint8_t *data, uint8_t *ecc_code);
  */
 extern int correct_data_rs(uint8_t *data, uint8_t *store_ecc, uint8_t *calc_ecc);
 
+/**
+ * verify_data_rs - Check a 512 byte block against its stored 10-byte ECC
+ * @dat:	raw data read from the chip, corrected in place
+ * @store_ecc:	ECC from the chip
+ *
+ * The syndromes are computed directly from data and stored ECC, the
+ * Berlekamp-Massey decoder only runs when one of them is non-zero.
+ * Returns the number of corrected symbols (0 for a clean or erased block)
+ * or -1 if the errors can't be corrected.
+ */
+extern int verify_data_rs(uint8_t *data, const uint8_t *store_ecc);
+
+/**
+ * verify_blocks_rs - verify_data_rs() for a number of blocks
+ * @data:	raw data of each block, corrected in place
+ * @store_ecc:	stored ECC of each block
+ * @count:	number of blocks
+ * @result:	verify_data_rs() result of each block, may be NULL
+ *
+ * The syndromes of independent blocks are computed in lock-step with the
+ * best vector kernel the cpu supports.  Returns the number of blocks that
+ * can't be corrected.
+ */
+extern int verify_blocks_rs(uint8_t *const *data, const uint8_t *const *store_ecc,
+		int count, int *result);
+
+/**
+ * rs_syndrome_kernel - Name of the syndrome kernel used by verify_blocks_rs
+ */
+extern const char *rs_syndrome_kernel(void);
+
+/**
+ * rs_set_syndrome_kernel - Force a syndrome kernel
+ * @name:	"scalar", "sse2", "avx2" or "neon"
+ *
+ * Changes the default context for all later calls.  Returns -1 if the
+ * kernel isn't available on this cpu.  All kernels give bit-identical
+ * results, this is for testing and benchmarking.
+ */
+extern int rs_set_syndrome_kernel(const char *name);
+
+/*
+ * Reentrant interface.  A struct rs_codec holds the choice of syndrome
+ * kernel; the codec tables are constant, so a context can be shared by any
+ * number of threads without locking.  The calls above use a default
+ * context, the calls below take one explicitly (NULL for the default).
+ */
+struct rs_codec;
+
+/**
+ * rs_codec_get - Get an ECC context
+ * @kernel:	syndrome kernel name, NULL for the best one the cpu supports
+ *
+ * Contexts are static and immutable, there is nothing to free.  Returns
+ * NULL if the kernel isn't available on this cpu.
+ */
+extern const struct rs_codec *rs_codec_get(const char *kernel);
+
+/**
+ * rs_codec_kernel - Name of the syndrome kernel of a context
+ * @codec:	context, NULL for the default
+ */
+extern const char *rs_codec_kernel(const struct rs_codec *codec);
+
+/**
+ * rs_encode_blocks - calculate_ecc_rs() for a number of blocks
+ * @codec:	context, NULL for the default
+ * @data:	raw data of each block
+ * @ecc_code:	ECC buffer of each block
+ * @count:	number of blocks
+ */
+extern void rs_encode_blocks(const struct rs_codec *codec,
+		const uint8_t *const *data, uint8_t *const *ecc_code, int count);
+
+/**
+ * rs_verify_blocks - verify_blocks_rs() with an explicit context
+ * @codec:	context, NULL for the default
+ * @data:	raw data of each block, corrected in place
+ * @store_ecc:	stored ECC of each block
+ * @count:	number of blocks
+ * @result:	verify_data_rs() result of each block, may be NULL
+ *
+ * Returns the number of blocks that can't be corrected.
+ */
+extern int rs_verify_blocks(const struct rs_codec *codec,
+		uint8_t *const *data, const uint8_t *const *store_ecc,
+		int count, int *result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,251 @@
+/*
+ * Vectorized Reed-Solomon syndrome kernels, see ecc_rs_simd.h
+ *
+ * Each lane holds one block's partial syndrome, a GF(2**10) element in a
+ * 16 bit lane.  Multiplying by @**i (i = 1..8) is a shift by i, the bits
+ * shifted past x**9 are folded back with x**10 = x**3 + 1; for i = 8 that
+ * fold can itself reach x**10 and is applied a second time.
+ */
+
+#include "ecc_rs_simd.h"
+
+/* one Horner step of all eight syndromes with the data symbols in d */
+#define HORNER(mul, xor, d) do {		\
+		s1 = xor(mul(s1, 1), d);	\
+		s2 = xor(mul(s2, 2), d);	\
+		s3 = xor(mul(s3, 3), d);	\
+		s4 = xor(mul(s4, 4), d);	\
+		s5 = xor(mul(s5, 5), d);	\
+		s6 = xor(mul(s6, 6), d);	\
+		s7 = xor(mul(s7, 7), d);	\
+		s8 = xor(mul(s8, 8), d);	\
+	} while (0)
+
+#ifdef RS_SYN_X86
+
+#include <immintrin.h>
+
+#define SSE2 __attribute__((target("sse2")))
+#define AVX2 __attribute__((target("avx2")))
+#define INLINE static inline __attribute__((always_inline))
+
+INLINE SSE2 __m128i mul_sse2(__m128i x, const int i)
+{
+	const __m128i m = _mm_set1_epi16(0x3ff);
+	__m128i h = _mm_srli_epi16(x, 10 - i);
+	__m128i t = _mm_xor_si128(_mm_and_si128(_mm_slli_epi16(x, i), m),
+			_mm_xor_si128(h, _mm_slli_epi16(h, 3)));
+
+	if (i == 8) {
+		h = _mm_srli_epi16(t, 10);
+		t = _mm_xor_si128(_mm_and_si128(t, m),
+				_mm_xor_si128(h, _mm_slli_epi16(h, 3)));
+	}
+	return t;
+}
+
+INLINE AVX2 __m256i mul_avx2(__m256i x, const int i)
+{
+	const __m256i m = _mm256_set1_epi16(0x3ff);
+	__m256i h = _mm256_srli_epi16(x, 10 - i);
+	__m256i t = _mm256_xor_si256(_mm256_and_si256(_mm256_slli_epi16(x, i), m),
+			_mm256_xor_si256(h, _mm256_slli_epi16(h, 3)));
+
+	if (i == 8) {
+		h = _mm256_srli_epi16(t, 10);
+		t = _mm256_xor_si256(_mm256_and_si256(t, m),
+				_mm256_xor_si256(h, _mm256_slli_epi16(h, 3)));
+	}
+	return t;
+}
+
+/*
+ * Transpose bytes j..j+7 of 8 blocks: v[n] holds byte j+2n of the 8 blocks
+ * in its low half and byte j+2n+1 in its high half
+ */
+INLINE SSE2 void transpose8x8(const uint8_t *const *data, int j, __m128i v[4])
+{
+	__m128i t0 = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)(data[0] + j)),
+			_mm_loadl_epi64((const __m128i *)(data[1] + j)));
+	__m128i t1 = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)(data[2] + j)),
+			_mm_loadl_epi64((const __m128i *)(data[3] + j)));
+	__m128i t2 = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)(data[4] + j)),
+			_mm_loadl_epi64((const __m128i *)(data[5] + j)));
+	__m128i t3 = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i *)(data[6] + j)),
+			_mm_loadl_epi64((const __m128i *)(data[7] + j)));
+	__m128i u0 = _mm_unpacklo_epi16(t0, t1);
+	__m128i u1 = _mm_unpackhi_epi16(t0, t1);
+	__m128i u2 = _mm_unpacklo_epi16(t2, t3);
+	__m128i u3 = _mm_unpackhi_epi16(t2, t3);
+
+	v[0] = _mm_unpacklo_epi32(u0, u2);
+	v[1] = _mm_unpackhi_epi32(u0, u2);
+	v[2] = _mm_unpacklo_epi32(u1, u3);
+	v[3] = _mm_unpackhi_epi32(u1, u3);
+}
+
+SSE2 int rs_syn_sse2(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count)
+{
+	const __m128i z = _mm_setzero_si128();
+	uint16_t lanes[RS_SYN_COUNT][8] __attribute__((aligned(16)));
+	__m128i s1, s2, s3, s4, s5, s6, s7, s8, v[4], d;
+	int b, i, j, n;
+
+	for (b = 0; b + 8 <= count; b += 8) {
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 8; n++)
+				lanes[i][n] = acc[b + n][i];
+		s1 = _mm_load_si128((const __m128i *)lanes[0]);
+		s2 = _mm_load_si128((const __m128i *)lanes[1]);
+		s3 = _mm_load_si128((const __m128i *)lanes[2]);
+		s4 = _mm_load_si128((const __m128i *)lanes[3]);
+		s5 = _mm_load_si128((const __m128i *)lanes[4]);
+		s6 = _mm_load_si128((const __m128i *)lanes[5]);
+		s7 = _mm_load_si128((const __m128i *)lanes[6]);
+		s8 = _mm_load_si128((const __m128i *)lanes[7]);
+
+		for (j = RS_SYN_DATA - 8; j >= 0; j -= 8) {
+			transpose8x8(data + b, j, v);
+			for (n = 3; n >= 0; n--) {
+				d = _mm_unpackhi_epi8(v[n], z);
+				HORNER(mul_sse2, _mm_xor_si128, d);
+				d = _mm_unpacklo_epi8(v[n], z);
+				HORNER(mul_sse2, _mm_xor_si128, d);
+			}
+		}
+
+		_mm_store_si128((__m128i *)lanes[0], s1);
+		_mm_store_si128((__m128i *)lanes[1], s2);
+		_mm_store_si128((__m128i *)lanes[2], s3);
+		_mm_store_si128((__m128i *)lanes[3], s4);
+		_mm_store_si128((__m128i *)lanes[4], s5);
+		_mm_store_si128((__m128i *)lanes[5], s6);
+		_mm_store_si128((__m128i *)lanes[6], s7);
+		_mm_store_si128((__m128i *)lanes[7], s8);
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 8; n++)
+				acc[b + n][i] = lanes[i][n];
+	}
+	return b;
+}
+
+AVX2 int rs_syn_avx2(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count)
+{
+	uint16_t lanes[RS_SYN_COUNT][16] __attribute__((aligned(32)));
+	__m256i s1, s2, s3, s4, s5, s6, s7, s8, d;
+	__m128i lo[4], hi[4];
+	int b, i, j, n;
+
+	for (b = 0; b + 16 <= count; b += 16) {
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 16; n++)
+				lanes[i][n] = acc[b + n][i];
+		s1 = _mm256_load_si256((const __m256i *)lanes[0]);
+		s2 = _mm256_load_si256((const __m256i *)lanes[1]);
+		s3 = _mm256_load_si256((const __m256i *)lanes[2]);
+		s4 = _mm256_load_si256((const __m256i *)lanes[3]);
+		s5 = _mm256_load_si256((const __m256i *)lanes[4]);
+		s6 = _mm256_load_si256((const __m256i *)lanes[5]);
+		s7 = _mm256_load_si256((const __m256i *)lanes[6]);
+		s8 = _mm256_load_si256((const __m256i *)lanes[7]);
+
+		for (j = RS_SYN_DATA - 8; j >= 0; j -= 8) {
+			transpose8x8(data + b, j, lo);
+			transpose8x8(data + b + 8, j, hi);
+			for (n = 3; n >= 0; n--) {
+				d = _mm256_cvtepu8_epi16(_mm_unpackhi_epi64(lo[n], hi[n]));
+				HORNER(mul_avx2, _mm256_xor_si256, d);
+				d = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(lo[n], hi[n]));
+				HORNER(mul_avx2, _mm256_xor_si256, d);
+			}
+		}
+
+		_mm256_store_si256((__m256i *)lanes[0], s1);
+		_mm256_store_si256((__m256i *)lanes[1], s2);
+		_mm256_store_si256((__m256i *)lanes[2], s3);
+		_mm256_store_si256((__m256i *)lanes[3], s4);
+		_mm256_store_si256((__m256i *)lanes[4], s5);
+		_mm256_store_si256((__m256i *)lanes[5], s6);
+		_mm256_store_si256((__m256i *)lanes[6], s7);
+		_mm256_store_si256((__m256i *)lanes[7], s8);
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 16; n++)
+				acc[b + n][i] = lanes[i][n];
+	}
+	return b;
+}
+
+#endif /* RS_SYN_X86 */
+
+#ifdef RS_SYN_NEON
+
+#include <arm_neon.h>
+
+static inline uint16x8_t mul_neon(uint16x8_t x, const int i)
+{
+	const uint16x8_t m = vdupq_n_u16(0x3ff);
+	uint16x8_t h = vshlq_u16(x, vdupq_n_s16(i - 10));
+	uint16x8_t t = veorq_u16(vandq_u16(vshlq_u16(x, vdupq_n_s16(i)), m),
+			veorq_u16(h, vshlq_u16(h, vdupq_n_s16(3))));
+
+	if (i == 8) {
+		h = vshlq_u16(t, vdupq_n_s16(-10));
+		t = veorq_u16(vandq_u16(t, m),
+				veorq_u16(h, vshlq_u16(h, vdupq_n_s16(3))));
+	}
+	return t;
+}
+
+int rs_syn_neon(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count)
+{
+	uint16_t lanes[RS_SYN_COUNT][8];
+	uint16_t sym[8][8];
+	uint16x8_t s1, s2, s3, s4, s5, s6, s7, s8, d;
+	int b, i, j, n;
+
+	for (b = 0; b + 8 <= count; b += 8) {
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 8; n++)
+				lanes[i][n] = acc[b + n][i];
+		s1 = vld1q_u16(lanes[0]);
+		s2 = vld1q_u16(lanes[1]);
+		s3 = vld1q_u16(lanes[2]);
+		s4 = vld1q_u16(lanes[3]);
+		s5 = vld1q_u16(lanes[4]);
+		s6 = vld1q_u16(lanes[5]);
+		s7 = vld1q_u16(lanes[6]);
+		s8 = vld1q_u16(lanes[7]);
+
+		for (j = RS_SYN_DATA - 8; j >= 0; j -= 8) {
+			for (i = 0; i < 8; i++)
+				for (n = 0; n < 8; n++)
+					sym[i][n] = data[b + n][j + i];
+			for (i = 7; i >= 0; i--) {
+				d = vld1q_u16(sym[i]);
+				HORNER(mul_neon, veorq_u16, d);
+			}
+		}
+
+		vst1q_u16(lanes[0], s1);
+		vst1q_u16(lanes[1], s2);
+		vst1q_u16(lanes[2], s3);
+		vst1q_u16(lanes[3], s4);
+		vst1q_u16(lanes[4], s5);
+		vst1q_u16(lanes[5], s6);
+		vst1q_u16(lanes[6], s7);
+		vst1q_u16(lanes[7], s8);
+		for (i = 0; i < RS_SYN_COUNT; i++)
+			for (n = 0; n < 8; n++)
+				acc[b + n][i] = lanes[i][n];
+	}
+	return b;
+}
+
+#endif /* RS_SYN_NEON */
@@ -0,0 +1,50 @@
+/*
+  Internal interface between ecc_rs.cxx and the vectorized syndrome kernels
+*/
+
+#ifndef ECC_RS_SIMD_H
+#define ECC_RS_SIMD_H
+
+#include <stdint.h>
+
+#define RS_SYN_DATA 512	/* data bytes per block */
+#define RS_SYN_COUNT 8	/* syndromes per block, roots @**1 .. @**8 */
+
+/*
+ * A kernel continues Horner's rule over the RS_SYN_DATA data bytes of a
+ * group of blocks in lock-step, one block per vector lane.  acc[b][i] holds
+ * the partial syndrome i of block b (parity and zero gap already folded in,
+ * polynomial form) on entry and the final syndrome on return.  Only whole
+ * groups are processed, the number of blocks handled is returned and the
+ * caller finishes the rest with the scalar code.
+ *
+ * The multiplications by @**i are done with shifts and the reduction
+ * x**10 = x**3 + 1, so the results are bit-identical to the table driven
+ * scalar code.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int (*rs_syn_kernel)(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count);
+
+#if defined(__x86_64__) || defined(__i386__)
+extern int rs_syn_sse2(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count);
+extern int rs_syn_avx2(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count);
+#define RS_SYN_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+extern int rs_syn_neon(const uint8_t *const *data,
+		uint16_t (*acc)[RS_SYN_COUNT], int count);
+#define RS_SYN_NEON 1
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
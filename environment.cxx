@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <cstring>
+#include "environment.h"
+
+using namespace std;
+
+Environment::Environment()
+	: live_(0)
+	, liveBytes_(0)
+{
+}
+
+void Environment::load(const uint8_t *vars, size_t size)
+{
+	arena_.assign((const char *)vars, (const char *)vars + size);
+	entries_.clear();
+	slots_.clear();
+	live_ = 0;
+	liveBytes_ = 0;
+
+	// the variables stay where they are in the arena, only indexed
+	const char *base = arena_.data();
+	size_t pos = 0;
+
+	while ( pos < size )
+	{
+		const char *var = base + pos;
+		const char *nul = (const char *)memchr(var, '\0', size - pos);
+		size_t n = (nul ? nul : base + size) - var;
+
+		pos += n + 1;
+
+		// u-boot skips what isn't "name=value" as well
+		const char *eq = (const char *)memchr(var, '=', n);
+
+		if ( ! eq || eq == var )
+			continue;
+
+		if ( ! nul )	// an unterminated last variable gets its NUL
+		{
+			arena_.push_back('\0');
+			base = arena_.data();
+			var = base + pos - n - 1;
+		}
+
+		add(string_view(var, n));
+	}
+
+	compact();
+}
+
+bool Environment::get(string_view name, string_view &value) const
+{
+	if ( slots_.empty() )
+		return false;
+
+	uint32_t slot = slots_[find(name, hash(name))];
+
+	if ( ! slot )
+		return false;
+
+	const Entry &e(entries_[slot - 1]);
+
+	value = string_view(&arena_[e.offset + e.nameLen + 1], e.len - e.nameLen - 1);
+	return true;
+}
+
+void Environment::set(string_view name, string_view value)
+{
+	const uint32_t h = hash(name);
+
+	if ( (live_ + 1) * 2 > slots_.size() )
+		rehash(slots_.empty() ? 64 : slots_.size() * 2);
+
+	size_t i = find(name, h);
+
+	if ( slots_[i] )
+	{
+		Entry &e(entries_[slots_[i] - 1]);
+
+		liveBytes_ -= e.len + 1;
+
+		// a value of the same size is overwritten where it is
+		if ( e.len == name.size() + 1 + value.size() )
+			memcpy(&arena_[e.offset + e.nameLen + 1], value.data(), value.size());
+		else
+			append(slots_[i] - 1, name, value);
+
+		liveBytes_ += e.len + 1;
+	}
+	else
+	{
+		entries_.push_back(Entry());
+		entries_.back().hash = h;
+		append(entries_.size() - 1, name, value);
+		slots_[i] = entries_.size();
+		++live_;
+		liveBytes_ += entries_.back().len + 1;
+	}
+
+	compact();
+}
+
+bool Environment::erase(string_view name)
+{
+	if ( slots_.empty() )
+		return false;
+
+	const size_t mask = slots_.size() - 1;
+	size_t i = find(name, hash(name));
+
+	if ( ! slots_[i] )
+		return false;
+
+	Entry &e(entries_[slots_[i] - 1]);
+
+	liveBytes_ -= e.len + 1;
+	e.len = 0;
+	--live_;
+
+	// backward shift: pull up every following entry that may not sit
+	// behind the hole, no tombstones needed
+	for ( size_t j = (i + 1) & mask; slots_[j]; j = (j + 1) & mask )
+	{
+		size_t home = entries_[slots_[j] - 1].hash & mask;
+
+		if ( ((j - home) & mask) >= ((j - i) & mask) )
+		{
+			slots_[i] = slots_[j];
+			i = j;
+		}
+	}
+
+	slots_[i] = 0;
+	compact();
+	return true;
+}
+
+void Environment::serialize(uint8_t *out) const
+{
+	for ( const Entry &e : entries_ )
+	{
+		if ( e.len )
+		{
+			memcpy(out, &arena_[e.offset], e.len + 1);
+			out += e.len + 1;
+		}
+	}
+}
+
+// FNV-1a
+uint32_t Environment::hash(string_view name)
+{
+	uint32_t h = 2166136261u;
+
+	for ( unsigned char c : name )
+		h = (h ^ c) * 16777619u;
+
+	return h;
+}
+
+size_t Environment::find(string_view name, uint32_t h) const
+{
+	const size_t mask = slots_.size() - 1;
+
+	for ( size_t i = h & mask; ; i = (i + 1) & mask )
+	{
+		if ( ! slots_[i] )
+			return i;
+
+		const Entry &e(entries_[slots_[i] - 1]);
+
+		if ( e.hash == h && nameOf(e) == name )
+			return i;
+	}
+}
+
+string_view Environment::nameOf(const Entry &e) const
+{
+	return string_view(&arena_[e.offset], e.nameLen);
+}
+
+// "name=value\0" at the end of the arena for entries_[entry]
+void Environment::append(size_t entry, string_view name, string_view value)
+{
+	Entry &e(entries_[entry]);
+
+	e.offset = arena_.size();
+	e.nameLen = name.size();
+	e.len = name.size() + 1 + value.size();
+	arena_.insert(arena_.end(), name.begin(), name.end());
+	arena_.push_back('=');
+	arena_.insert(arena_.end(), value.begin(), value.end());
+	arena_.push_back('\0');
+}
+
+// index a variable already in the arena, a later duplicate wins
+void Environment::add(string_view var)
+{
+	string_view name(var.substr(0, var.find('=')));
+	const uint32_t h = hash(name);
+
+	if ( (live_ + 1) * 2 > slots_.size() )
+		rehash(slots_.empty() ? 64 : slots_.size() * 2);
+
+	size_t i = find(name, h);
+	Entry e;
+
+	e.offset = var.data() - arena_.data();
+	e.nameLen = name.size();
+	e.len = var.size();
+	e.hash = h;
+
+	if ( slots_[i] )
+	{
+		Entry &old(entries_[slots_[i] - 1]);
+
+		liveBytes_ -= old.len + 1;
+		old.offset = e.offset;
+		old.len = e.len;
+	}
+	else
+	{
+		entries_.push_back(e);
+		slots_[i] = entries_.size();
+		++live_;
+	}
+
+	liveBytes_ += e.len + 1;
+}
+
+// slots must be a power of 2 above the live entries
+void Environment::rehash(size_t slots)
+{
+	slots_.assign(slots, 0);
+
+	for ( size_t n = 0; n < entries_.size(); ++n )
+		if ( entries_[n].len )
+			slots_[find(nameOf(entries_[n]), entries_[n].hash)] = n + 1;
+}
+
+// drop deleted entries and stale values once they outweigh the live ones
+void Environment::compact()
+{
+	if ( arena_.size() - liveBytes_ <= liveBytes_ + 4096
+			&& entries_.size() - live_ <= live_ + 64 )
+		return;
+
+	vector<char> arena;
+	vector<Entry> entries;
+
+	arena.reserve(liveBytes_ * 2);
+	entries.reserve(live_);
+
+	for ( const Entry &e : entries_ )
+	{
+		if ( e.len )
+		{
+			entries.push_back(e);
+			entries.back().offset = arena.size();
+			arena.insert(arena.end(), &arena_[e.offset], &arena_[e.offset] + e.len + 1);
+		}
+	}
+
+	arena_.swap(arena);
+	entries_.swap(entries);
+
+	size_t slots = 64;
+
+	while ( slots < live_ * 2 )
+		slots *= 2;
+
+	rehash(slots);
+}
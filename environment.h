@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+#include <vector>
+
+/*
+ * The variables of a u-boot env, in order.
+ *
+ * Every "name=value" lives NUL terminated in one flat arena, a variable is
+ * an entry pointing into it and an open addressing table of entry numbers
+ * finds a name in O(1).  set() of a new value appends it to the arena and
+ * repoints the entry, so the variable keeps its place; deleted entries and
+ * stale values are squeezed out once they take up more than the live ones.
+ * serialize() copies the live variables straight into the env layout.
+ */
+class Environment
+{
+public:
+	Environment();
+
+	// replace the contents with the NUL separated variables of an env
+	void load(const uint8_t *vars, size_t size);
+
+	bool get(std::string_view name, std::string_view &value) const;
+
+	// a new name goes last, the name must not contain '='
+	void set(std::string_view name, std::string_view value);
+
+	// false if there is no such variable
+	bool erase(std::string_view name);
+
+	size_t count() const { return live_; }
+
+	// bytes serialize() writes
+	size_t bytes() const { return liveBytes_; }
+
+	// the variables, each followed by its NUL, to out[0 .. bytes())
+	void serialize(uint8_t *out) const;
+
+	// fn(name, value) for every variable in order
+	template <class F>
+	void forEach(F fn) const
+	{
+		for ( const Entry &e : entries_ )
+			if ( e.len )
+				fn(std::string_view(&arena_[e.offset], e.nameLen),
+						std::string_view(&arena_[e.offset + e.nameLen + 1],
+								e.len - e.nameLen - 1));
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t offset;	// of "name=value" in the arena
+		uint32_t nameLen;
+		uint32_t len;		// of "name=value", 0: deleted
+		uint32_t hash;
+	};
+
+	static uint32_t hash(std::string_view name);
+
+	// slot of name, or of the empty slot where it would go
+	size_t find(std::string_view name, uint32_t h) const;
+	std::string_view nameOf(const Entry &e) const;
+	void append(size_t entry, std::string_view name, std::string_view value);
+	void add(std::string_view var);
+	void rehash(size_t slots);
+	void compact();
+
+	std::vector<char> arena_;
+	std::vector<Entry> entries_;
+	std::vector<uint32_t> slots_;	// entry + 1, 0: empty
+	size_t live_;
+	size_t liveBytes_;		// live "name=value\0" in the arena
+};
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef GALOIS_H
+#define GALOIS_H
+
+#include <stdint.h>
+
+/*
+ * log/antilog tables of GF(2**M), built by the compiler.
+ *
+ * Elements are in polynomial form (bit i is the coefficient of x**i) and
+ * alpha = x is primitive for the irreducible polynomial Poly (bit M set).
+ * The antilog table holds alpha**0 .. alpha**(N-1) twice and is zero from
+ * 2*N up to 4*N, log(0) is 2*N: the sum of two logs indexes the product
+ * directly, sums of two non-zero logs stay below 2*N and any sum involving
+ * log(0) lands in the zero part.
+ */
+template <unsigned M, unsigned Poly>
+struct GaloisTables
+{
+	static constexpr unsigned Size = 1u << M;
+	static constexpr unsigned N = Size - 1;
+	static constexpr unsigned LogZero = 2 * N;
+
+	uint16_t exp[4 * N + 1];
+	uint16_t log[Size];
+
+	constexpr GaloisTables()
+		: exp()
+		, log()
+	{
+		unsigned x = 1;
+
+		for ( unsigned i = 0; i < N; ++i )
+		{
+			exp[i] = exp[i + N] = x;
+			log[x] = i;
+			x <<= 1;
+
+			if ( x & Size )
+				x ^= Poly;
+		}
+
+		log[0] = LogZero;
+	}
+};
+
+template <unsigned M, unsigned Poly>
+class GaloisField
+{
+public:
+	typedef uint16_t Elem;
+
+	static constexpr unsigned Bits = M;
+	static constexpr unsigned Size = GaloisTables<M, Poly>::Size;	// elements
+	static constexpr unsigned N = GaloisTables<M, Poly>::N;	// order of alpha
+	static constexpr unsigned LogZero = GaloisTables<M, Poly>::LogZero;
+
+	static constexpr unsigned log(Elem a) { return tables_.log[a]; }
+
+	// alpha**e, e < 2*N
+	static constexpr Elem exp(unsigned e) { return tables_.exp[e]; }
+
+	// alpha**e for any e
+	static constexpr Elem pow(unsigned long e) { return tables_.exp[e % N]; }
+
+	static constexpr Elem mul(Elem a, Elem b)
+	{
+		return tables_.exp[tables_.log[a] + tables_.log[b]];
+	}
+
+	// a * alpha**e, e <= N
+	static constexpr Elem mulExp(Elem a, unsigned e)
+	{
+		return tables_.exp[tables_.log[a] + e];
+	}
+
+	// a / b, b != 0
+	static constexpr Elem div(Elem a, Elem b)
+	{
+		return tables_.exp[tables_.log[a] + N - tables_.log[b]];
+	}
+
+private:
+	static constexpr GaloisTables<M, Poly> tables_ = GaloisTables<M, Poly>();
+};
+
+#endif
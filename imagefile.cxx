@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+#include "imagefile.h"
+
+using namespace std;
+
+ImageFile::ImageFile(const string &file, bool writable, unsigned pageSize,
+		unsigned oobSize, unsigned blockPages, unsigned newBlocks)
+	: file_(file)
+	, writable_(writable)
+	, map_(0)
+	, size_(0)
+	, dirty_(false)
+{
+	const size_t rawBlock = (size_t)(pageSize + oobSize) * blockPages;
+	int fd = open(file_.c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	struct stat st;
+
+	if ( fd < 0 || fstat(fd, &st) != 0 )
+	{
+		cerr << "ImageFile(): unable to open " << file_ << ": " << strerror(errno) << endl;
+		exit(1);
+	}
+
+	size_ = st.st_size;
+
+	if ( size_ == 0 && writable )
+	{
+		size_ = rawBlock * newBlocks;
+
+		if ( ftruncate(fd, size_) != 0 )
+		{
+			cerr << "ImageFile(): unable to create " << file_ << ": " << strerror(errno) << endl;
+			exit(1);
+		}
+
+		dirty_ = true;
+	}
+
+	if ( size_ == 0 || size_ % rawBlock )
+	{
+		cerr << "ImageFile(): " << file_ << " is not a dump of whole blocks of "
+				<< blockPages << " pages of " << pageSize << "+" << oobSize << " bytes" << endl;
+		exit(1);
+	}
+
+	void *map = mmap(0, size_, PROT_READ | PROT_WRITE,
+			writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if ( map == MAP_FAILED )
+	{
+		cerr << "ImageFile(): unable to map " << file_ << ": " << strerror(errno) << endl;
+		exit(1);
+	}
+
+	map_ = (uint8_t *)map;
+
+	if ( dirty_ )
+		memset(map_, 0xff, size_);
+
+	memset(&info_, 0, sizeof(info_));
+	info_.type = MTD_NANDFLASH;
+	info_.size = size_ / rawBlock * blockPages * pageSize;
+	info_.erasesize = blockPages * pageSize;
+	info_.writesize = pageSize;
+	info_.oobsize = oobSize;
+}
+
+ImageFile::~ImageFile()
+{
+	if ( dirty_ && msync(map_, size_, MS_SYNC) != 0 )
+		cerr << "ImageFile(): msync failed on " << file_ << ": " << strerror(errno) << endl;
+
+	munmap(map_, size_);
+}
+
+uint8_t *ImageFile::pages(uint32_t offset, unsigned pages)
+{
+	uint64_t rel = offset;
+	uint64_t end = info_.size;	// of what the pages may span
+
+	// a listed block can't run into the next one in the file
+	if ( ! blocks_.empty() )
+	{
+		const uint32_t within = offset % info_.erasesize;
+		const size_t i = find(blocks_.begin(), blocks_.end(), offset - within) - blocks_.begin();
+
+		rel = (uint64_t)i * info_.erasesize + within;
+		end = i < blocks_.size() ? rel - within + info_.erasesize : 0;
+	}
+
+	if ( rel % info_.writesize || rel + (uint64_t)pages * info_.writesize > end )
+	{
+		cerr << "ImageFile(): 0x" << hex << offset << dec << " is not within "
+				<< file_ << endl;
+		exit(1);
+	}
+
+	return map_ + rel / info_.writesize * (info_.writesize + info_.oobsize);
+}
+
+bool ImageFile::readPages(uint32_t offset, unsigned pages, uint8_t *buf, string &error)
+{
+	memcpy(buf, this->pages(offset, pages), (size_t)pages * (info_.writesize + info_.oobsize));
+	return true;
+}
+
+// shared pages belong to the file, they are never handed out for changes
+uint8_t *ImageFile::mapPages(uint32_t offset, unsigned pages)
+{
+	return writable_ ? 0 : this->pages(offset, pages);
+}
+
+bool ImageFile::isBad(uint32_t offset)
+{
+	uint32_t block = offset - (offset % info_.erasesize);
+
+	return pages(block, 1)[info_.writesize] != 0xff;
+}
+
+bool ImageFile::eccStats(mtd_ecc_stats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	return false;
+}
+
+void ImageFile::eraseBlock(uint32_t offset)
+{
+	const unsigned blockPages = info_.erasesize / info_.writesize;
+
+	if ( offset % info_.erasesize )
+	{
+		cerr << "ImageFile(): 0x" << hex << offset << dec
+				<< " is not an eraseblock boundary of " << file_ << endl;
+		exit(1);
+	}
+
+	memset(pages(offset, blockPages), 0xff,
+			(size_t)blockPages * (info_.writesize + info_.oobsize));
+	dirty_ = true;
+}
+
+void ImageFile::writePages(uint32_t offset, unsigned pages, const uint8_t *buf)
+{
+	memcpy(this->pages(offset, pages), buf, (size_t)pages * (info_.writesize + info_.oobsize));
+	dirty_ = true;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef IMAGEFILE_H
+#define IMAGEFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mtd.h"
+
+/*
+ * A raw nand dump (pages with OOB, as nanddump -o writes them) used like
+ * the partition it was taken from.
+ *
+ * The file is mmap()ed: read-only it is a private mapping and mapPages()
+ * hands out the pages to be corrected in place, writable it is shared and
+ * everything written is flushed with one msync() when the object goes.
+ * A block whose first OOB byte isn't 0xff is bad, an erase fills the block
+ * with 0xff.
+ */
+class ImageFile : public NandDevice
+{
+public:
+	// a writable file that doesn't exist or is empty is created with
+	// 'newBlocks' erased blocks
+	ImageFile(const std::string &file, bool writable, unsigned pageSize,
+			unsigned oobSize, unsigned blockPages, unsigned newBlocks = 1);
+	~ImageFile();
+
+	// partition offsets of the blocks in the file, in file order, for a
+	// dump of just the blocks of interest
+	void setBlocks(const std::vector<uint32_t> &offsets) { blocks_ = offsets; }
+
+	bool readPages(uint32_t offset, unsigned pages, uint8_t *buf, std::string &error);
+	uint8_t *mapPages(uint32_t offset, unsigned pages);
+	bool isBad(uint32_t offset);
+	bool eccStats(mtd_ecc_stats &stats);
+	void eraseBlock(uint32_t offset);
+	void writePages(uint32_t offset, unsigned pages, const uint8_t *buf);
+
+private:
+	ImageFile(const ImageFile &);
+	ImageFile &operator=(const ImageFile &);
+
+	// the raw pages at 'offset', exits if they aren't all in the file
+	uint8_t *pages(uint32_t offset, unsigned pages);
+
+	std::string file_;
+	bool writable_;
+	uint8_t *map_;
+	size_t size_;		// of the file
+	std::vector<uint32_t> blocks_;	// empty: the file starts at offset 0
+	bool dirty_;
+};
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "mtd.h"
+
+using namespace std;
+
+MtdDevice::MtdDevice(const string &dev, bool writable)
+	: dev_(dev)
+	, fd_(-1)
+{
+	fd_ = open(dev_.c_str(), writable ? O_RDWR : O_RDONLY);
+
+	if ( fd_ < 0 )
+	{
+		cerr << "MtdDevice(): unable to open " << dev_ << ": "
+				<< strerror(errno) << endl;
+		exit(1);
+	}
+
+	if ( ioctl(fd_, MEMGETINFO, &info_) != 0 )
+	{
+		cerr << "MtdDevice(): MEMGETINFO failed on " << dev_ << ": "
+				<< strerror(errno) << endl;
+		exit(1);
+	}
+
+	if ( info_.type != MTD_NANDFLASH && info_.type != MTD_MLCNANDFLASH )
+	{
+		cerr << "MtdDevice(): " << dev_ << " is not a nand device" << endl;
+		exit(1);
+	}
+
+	fileMode(MTD_FILE_MODE_RAW);
+}
+
+MtdDevice::~MtdDevice()
+{
+	if ( fd_ >= 0 )
+		close(fd_);
+}
+
+void MtdDevice::checkBlock(uint32_t offset, unsigned pages)
+{
+	if ( offset % info_.writesize
+			|| offset + (uint64_t)pages * info_.writesize > info_.size )
+	{
+		cerr << "MtdDevice(): invalid range 0x" << hex << offset << dec
+				<< " on " << dev_ << endl;
+		exit(1);
+	}
+
+	for ( uint32_t o = offset - (offset % info_.erasesize)
+			; o < offset + pages * info_.writesize; o += info_.erasesize )
+	{
+		if ( isBad(o) )
+		{
+			cerr << "MtdDevice(): block at 0x" << hex << o << dec
+					<< " of " << dev_ << " is marked bad" << endl;
+			exit(1);
+		}
+	}
+}
+
+bool MtdDevice::isBad(uint32_t offset)
+{
+	loff_t blk(offset - (offset % info_.erasesize));
+	int r = ioctl(fd_, MEMGETBADBLOCK, &blk);
+
+	if ( r < 0 && errno != EOPNOTSUPP )
+	{
+		cerr << "MtdDevice(): MEMGETBADBLOCK failed on " << dev_ << ": "
+				<< strerror(errno) << endl;
+		exit(1);
+	}
+
+	return r > 0;
+}
+
+bool MtdDevice::eccStats(mtd_ecc_stats &stats)
+{
+	memset(&stats, 0, sizeof(stats));
+
+	if ( ioctl(fd_, ECCGETSTATS, &stats) == 0 )
+		return true;
+
+	if ( errno != EOPNOTSUPP && errno != ENOTTY )
+	{
+		cerr << "MtdDevice(): ECCGETSTATS failed on " << dev_ << ": "
+				<< strerror(errno) << endl;
+		exit(1);
+	}
+
+	return false;
+}
+
+bool MtdDevice::eccLayout(nand_ecclayout_user &layout)
+{
+	memset(&layout, 0, sizeof(layout));
+
+	if ( ioctl(fd_, ECCGETLAYOUT, &layout) == 0 )
+		return true;
+
+	if ( errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL )
+	{
+		cerr << "MtdDevice(): ECCGETLAYOUT failed on " << dev_ << ": "
+				<< strerror(errno) << endl;
+		exit(1);
+	}
+
+	return false;
+}
+
+bool MtdDevice::readPages(uint32_t offset, unsigned pages, uint8_t *buf, string &error)
+{
+	checkBlock(offset, pages);
+
+	for ( unsigned i = 0; i < pages; ++i )
+	{
+		uint32_t pageOffset = offset + i * info_.writesize;
+		ssize_t n = pread(fd_, buf, info_.writesize, pageOffset);
+
+		if ( n != (ssize_t)info_.writesize )
+		{
+			ostringstream err;
+			err << "MtdDevice(): read failed at 0x" << hex << pageOffset << dec
+					<< " of " << dev_ << ": "
+					<< (n < 0 ? strerror(errno) : "short read");
+			error = err.str();
+			return false;
+		}
+
+		buf += info_.writesize;
+
+		mtd_oob_buf oob;
+		oob.start = pageOffset;
+		oob.length = info_.oobsize;
+		oob.ptr = buf;
+
+		if ( ioctl(fd_, MEMREADOOB, &oob) != 0 )
+		{
+			ostringstream err;
+			err << "MtdDevice(): MEMREADOOB failed at 0x" << hex << pageOffset << dec
+					<< " of " << dev_ << ": " << strerror(errno);
+			error = err.str();
+			return false;
+		}
+
+		buf += info_.oobsize;
+	}
+
+	return true;
+}
+
+/*
+ * The normal mtdchar read: the driver corrects what it can and hands out
+ * the data of uncorrectable pages as well, only its ECC counters tell
+ */
+bool MtdDevice::readData(uint32_t offset, unsigned pages, uint8_t *buf)
+{
+	const size_t len = (size_t)pages * info_.writesize;
+
+	checkBlock(offset, pages);
+	fileMode(MTD_FILE_MODE_NORMAL);
+
+	ssize_t n = pread(fd_, buf, len, offset);
+	int err = errno;
+
+	fileMode(MTD_FILE_MODE_RAW);
+
+	if ( n != (ssize_t)len )
+	{
+		cerr << "MtdDevice(): read failed at 0x" << hex << offset << dec
+				<< " of " << dev_ << ": "
+				<< (n < 0 ? strerror(err) : "short read") << endl;
+		exit(1);
+	}
+
+	return true;
+}
+
+void MtdDevice::eraseBlock(uint32_t offset)
+{
+	if ( offset % info_.erasesize )
+	{
+		cerr << "MtdDevice(): 0x" << hex << offset << dec
+				<< " is not an eraseblock boundary of " << dev_ << endl;
+		exit(1);
+	}
+
+	checkBlock(offset, info_.erasesize / info_.writesize);
+
+	erase_info_user erase;
+	erase.start = offset;
+	erase.length = info_.erasesize;
+
+	if ( ioctl(fd_, MEMERASE, &erase) != 0 )
+	{
+		cerr << "MtdDevice(): MEMERASE failed at 0x" << hex << offset << dec
+				<< " of " << dev_ << ": " << strerror(errno) << endl;
+		exit(1);
+	}
+}
+
+void MtdDevice::writePages(uint32_t offset, unsigned pages, const uint8_t *buf)
+{
+	checkBlock(offset, pages);
+
+	for ( unsigned i = 0; i < pages; ++i )
+	{
+		uint32_t pageOffset = offset + i * info_.writesize;
+		mtd_write_req req;
+
+		memset(&req, 0, sizeof(req));
+		req.start = pageOffset;
+		req.len = info_.writesize;
+		req.ooblen = info_.oobsize;
+		req.usr_data = (uintptr_t)buf;
+		req.usr_oob = (uintptr_t)(buf + info_.writesize);
+		req.mode = MTD_OPS_RAW;
+
+		if ( ioctl(fd_, MEMWRITE, &req) != 0 )
+		{
+			cerr << "MtdDevice(): MEMWRITE failed at 0x" << hex << pageOffset << dec
+					<< " of " << dev_ << ": " << strerror(errno) << endl;
+			exit(1);
+		}
+
+		buf += info_.writesize + info_.oobsize;
+	}
+}
+
+void MtdDevice::fileMode(int mode)
+{
+	if ( ioctl(fd_, MTDFILEMODE, mode) != 0 )
+	{
+		cerr << "MtdDevice(): unable to select " << (mode == MTD_FILE_MODE_RAW ? "raw" : "normal")
+				<< " mode on " << dev_ << ": " << strerror(errno) << endl;
+		exit(1);
+	}
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef MTD_H
+#define MTD_H
+
+#include <stdint.h>
+#include <string>
+#include <mtd/mtd-user.h>
+
+/*
+ * Raw pages of a nand partition: page data followed by its OOB, the
+ * u-boot Reed-Solomon ECC in the OOB is handled by plugenv itself.
+ */
+class NandDevice
+{
+public:
+	virtual ~NandDevice() {}
+
+	const mtd_info_user &info() const { return info_; }
+
+	// read 'pages' pages starting at 'offset', each page followed by its
+	// OOB; false with the reason in 'error' if the device fails
+	virtual bool readPages(uint32_t offset, unsigned pages, uint8_t *buf, std::string &error) = 0;
+
+	// 'pages' raw pages at 'offset' in memory that may be corrected in
+	// place, without reading them; 0 if they must be read
+	virtual uint8_t *mapPages(uint32_t offset, unsigned pages) { return 0; }
+
+	// read the data of 'pages' pages starting at 'offset' (no OOB) as
+	// corrected by the driver's ECC, eccStats() tells how that went; false
+	// if the device has no ECC of its own
+	virtual bool readData(uint32_t offset, unsigned pages, uint8_t *buf) { return false; }
+
+	// true if the eraseblock containing 'offset' is marked bad
+	virtual bool isBad(uint32_t offset) = 0;
+
+	// the ECC counters of the partition (ECCGETSTATS), false if the
+	// driver has none
+	virtual bool eccStats(mtd_ecc_stats &stats) = 0;
+
+	// erase the eraseblock starting at 'offset'
+	virtual void eraseBlock(uint32_t offset) = 0;
+
+	// program 'pages' pages starting at 'offset' from the same layout
+	// readPages() produces: page data immediately followed by its OOB
+	virtual void writePages(uint32_t offset, unsigned pages, const uint8_t *buf) = 0;
+
+protected:
+	mtd_info_user info_;
+};
+
+/*
+ * Direct access to a nand mtd partition through the mtdchar ioctls.
+ *
+ * The device is switched to MTD_FILE_MODE_RAW so that pages are transferred
+ * without the kernel's ECC, only readData() goes through it.
+ */
+class MtdDevice : public NandDevice
+{
+public:
+	explicit MtdDevice(const std::string &dev, bool writable = false);
+	~MtdDevice();
+
+	bool readPages(uint32_t offset, unsigned pages, uint8_t *buf, std::string &error);
+	bool readData(uint32_t offset, unsigned pages, uint8_t *buf);
+	bool isBad(uint32_t offset);
+	bool eccStats(mtd_ecc_stats &stats);
+	void eraseBlock(uint32_t offset);
+	void writePages(uint32_t offset, unsigned pages, const uint8_t *buf);
+
+	// the kernel's OOB layout (ECCGETLAYOUT), false if the driver has none
+	bool eccLayout(nand_ecclayout_user &layout);
+
+private:
+	MtdDevice(const MtdDevice &);
+	MtdDevice &operator=(const MtdDevice &);
+
+	void checkBlock(uint32_t offset, unsigned pages);
+	void fileMode(int mode);
+
+	std::string dev_;
+	int fd_;
+};
+
+#endif
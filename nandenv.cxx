@@ -0,0 +1,515 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ * Copyright (C) 2010 Federico Heinz <fheinz@vialibre.org.ar>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "crc32.h"
+#include "nandenv.h"
+#include "stats.h"
+#include "workpool.h"
+
+using namespace std;
+
+unsigned jobCount(0);
+uint32_t redundOffset(0);
+NandLayout nandLayout = { 2048, 64, 24, 0x20000, 0xa0000, 0x20000 };
+
+namespace {
+
+bool allZero(const uint8_t *buf, size_t len)
+{
+	return len == 0 || (buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0);
+}
+
+/*
+ * The page geometry the raw pages are walked with.  The common layouts are
+ * fixed at compile time, so the page strides and the steps per page are
+ * constants and the loops over the steps of a page unroll; any other
+ * layout uses the same code with the values of nandLayout.
+ */
+template <unsigned PageSize, unsigned OobSize, unsigned EccOffset>
+struct FixedGeometry
+{
+	static constexpr unsigned pageSize = PageSize;
+	static constexpr unsigned eccOffset = EccOffset;
+	static constexpr unsigned steps = PageSize / ECC_CHUNK_SIZE;
+	static constexpr size_t rawPageSize = PageSize + OobSize;
+
+	static bool matches(const NandLayout &l)
+	{
+		return l.pageSize == PageSize && l.oobSize == OobSize && l.eccOffset == EccOffset;
+	}
+};
+
+typedef FixedGeometry<2048, 64, 24> Geometry2K;	// SheevaPlug
+typedef FixedGeometry<4096, 128, 48> Geometry4K;	// 4K page Kirkwood boards
+
+struct Geometry
+{
+	unsigned pageSize;
+	unsigned eccOffset;
+	unsigned steps;
+	size_t rawPageSize;
+
+	explicit Geometry(const NandLayout &l)
+		: pageSize(l.pageSize), eccOffset(l.eccOffset), steps(l.steps())
+		, rawPageSize(l.rawPageSize()) {}
+};
+
+// fn(geometry) with the geometry of nandLayout
+template <class F>
+auto withGeometry(F fn)
+{
+	if ( Geometry2K::matches(nandLayout) )
+		return fn(Geometry2K());
+
+	if ( Geometry4K::matches(nandLayout) )
+		return fn(Geometry4K());
+
+	return fn(Geometry(nandLayout));
+}
+
+// the data and ECC of the 512 byte blocks of consecutive raw pages
+template <class G, class Data, class Ecc>
+void blockPointers(const G &g, uint8_t *raw, size_t blocks, Data *data, Ecc *ecc)
+{
+	for ( size_t p = 0; p < blocks / g.steps; ++p )
+	{
+		uint8_t *page = raw + p * g.rawPageSize;
+
+		for ( unsigned i = 0; i < g.steps; ++i )
+		{
+			data[p * g.steps + i] = page + i * ECC_CHUNK_SIZE;
+			ecc[p * g.steps + i] = page + g.pageSize + g.eccOffset + i * ECC_SIZE;
+		}
+	}
+}
+
+// the data of raw page i
+template <class G>
+uint8_t *pageData(const G &g, uint8_t *raw, unsigned i)
+{
+	return raw + i * g.rawPageSize;
+}
+
+template <class G>
+void encodePages(const G &g, uint8_t *raw)
+{
+	PhaseTimer timer(EncodePhase, PhaseTimer::Wall);
+	const unsigned pages = nandLayout.envPages();
+	const size_t blockCount = pages * g.steps;
+	vector<const uint8_t *> data(blockCount);
+	vector<uint8_t *> ecc(blockCount);
+
+	{
+		PhaseTimer timer(EncodePhase, PhaseTimer::Cpu);
+
+		// last page first, so nothing is overwritten before it is moved
+		for ( int i = pages - 1; i >= 0; --i )
+		{
+			memmove(pageData(g, raw, i), raw + i * g.pageSize, g.pageSize);
+			memset(pageData(g, raw, i) + g.pageSize, -1, g.rawPageSize - g.pageSize);
+		}
+	}
+
+	blockPointers(g, raw, blockCount, data.data(), ecc.data());
+
+	const rs_codec *codec = rs_codec_get(NULL);
+
+	WorkPool(jobCount).run(blockCount, ECC_BATCH,
+			[&](size_t begin, size_t end)
+			{
+				PhaseTimer timer(EncodePhase, PhaseTimer::Cpu);
+
+				rs_encode_blocks(codec, data.data() + begin, ecc.data() + begin, end - begin);
+			});
+}
+
+template <class G>
+int verifyRaw(const G &g, uint8_t *raw, unsigned pages, int *result)
+{
+	const size_t blockCount = pages * g.steps;
+	vector<uint8_t *> data(blockCount);
+	vector<const uint8_t *> ecc(blockCount);
+
+	blockPointers(g, raw, blockCount, data.data(), ecc.data());
+
+	// all blocks are independent, verify them in parallel
+	const rs_codec *codec = rs_codec_get(NULL);
+	PhaseTimer timer(EccPhase, PhaseTimer::Wall);
+
+	WorkPool(jobCount).run(blockCount, ECC_BATCH,
+			[&](size_t begin, size_t end)
+			{
+				PhaseTimer timer(EccPhase, PhaseTimer::Cpu);
+
+				rs_verify_blocks(codec, data.data() + begin, ecc.data() + begin, end - begin,
+						result + begin);
+			});
+
+	return blockCount - count_if(result, result + blockCount,
+			[](int r) { return r >= 0; });
+}
+
+}; // anonymous namespace
+
+string checkLayout(const NandLayout &l)
+{
+	ostringstream err;
+
+	if ( l.pageSize == 0 || l.pageSize % ECC_CHUNK_SIZE )
+		err << "the page size " << l.pageSize << " is not a multiple of " << ECC_CHUNK_SIZE;
+	else if ( l.eccOffset == 0 || l.eccOffset + l.steps() * ECC_SIZE > l.oobSize )
+		err << "the " << l.steps() * ECC_SIZE << " bytes of ECC at " << l.eccOffset
+				<< " don't fit the " << l.oobSize << " byte oob behind the bad block marker";
+	else if ( l.blockSize == 0 || l.blockSize % l.pageSize )
+		err << "the eraseblock size 0x" << hex << l.blockSize << " is not a multiple of the page size";
+	else if ( l.envSize == 0 || l.envSize % l.pageSize || l.envSize > l.blockSize )
+		err << "the env size 0x" << hex << l.envSize << " is not a number of pages within an eraseblock";
+	else if ( l.envOffset % l.blockSize )
+		err << "the env offset 0x" << hex << l.envOffset << " is not at an eraseblock";
+	else if ( redundOffset && (redundOffset % l.blockSize || redundOffset == l.envOffset) )
+		err << "the redundant env offset 0x" << hex << redundOffset
+				<< " is not at another eraseblock than the env";
+
+	return err.str();
+}
+
+size_t envHeader()
+{
+	return redundOffset ? 5 : 4;
+}
+
+ByteSpan encodeEnv(istream &in, NandImage &image)
+{
+	ByteSpan env(image.bytes(), nandLayout.envSize);
+	size_t len = envHeader();
+
+	while ( in )
+	{
+		char buf[512];
+		in.getline(buf, sizeof(buf));
+
+		if ( in.gcount() > 4 ) // min valid length 4, i.e "a=c"
+		{
+			if ( buf[0] == '=' )
+			{
+				cerr << "invalid env variable assignment: '"
+						<< buf << "' aborting!" << endl;
+				exit(1);
+			}
+
+			appendVar(env, len, buf, strlen(buf));
+		}
+	}
+
+	sealEnv(env, len);
+	return env;
+}
+
+void appendVar(ByteSpan env, size_t &len, const char *var, size_t n)
+{
+	if ( len + n + 1 > env.size - 1 )
+	{
+		cerr << "environment size exceeded, aborting!" << endl;
+		exit(1);
+	}
+
+	memcpy(env.data + len, var, n);
+	env[len + n] = '\0';
+	len += n + 1;
+}
+
+void sealEnv(ByteSpan env, size_t len)
+{
+	memset(env.data + sizeof(uint32_t), 0, envHeader() - sizeof(uint32_t));
+	memset(env.data + len, 0, env.size - len);
+
+	// the padding is only extended over, not hashed
+	Crc crc;
+
+	crc.i = crc32Zeros(crc32(0, env.data + envHeader(), len - envHeader()),
+			env.size - len);
+	memcpy(env.data, crc.b, sizeof(crc.b));
+}
+
+TextSpan decodeEnvText(ByteSpan vars)
+{
+	replace(vars.begin(), vars.end(), (uint8_t)'\0', (uint8_t)'\n');
+	return TextSpan((const char *)vars.data, vars.size);
+}
+
+// zero pages (the padding) are only extended over
+uint32_t envCrc(ByteSpan env)
+{
+	PhaseTimer timer(CrcPhase);
+	const size_t pageSize = nandLayout.pageSize;
+	uint32_t crc = 0;
+
+	for ( size_t pos = envHeader(); pos < env.size; )
+	{
+		const size_t n = min(env.size - pos, pageSize - pos % pageSize);
+
+		crc = allZero(env.data + pos, n) ? crc32Zeros(crc, n) : crc32(crc, env.data + pos, n);
+		pos += n;
+	}
+
+	return crc;
+}
+
+/*
+ * Check the env of a copy and find its variables, up to and including the
+ * NUL terminating the last one
+ */
+bool decodeEnv(EnvCopy &copy)
+{
+	PhaseTimer timer(ParsePhase);
+	ByteSpan env(copy.env);
+	const size_t header = envHeader();
+
+	if ( env[env.size - 1] != '\0' )
+	{
+		copy.error = "decodeEnv(): environment must be terminated with '\\0'.";
+		return false;
+	}
+
+	// the variables end with an empty one
+	size_t end = env.size - 5;
+	const uint8_t *last = env.data + env.size - 5;
+
+	for ( const uint8_t *p = env.data + header;
+			(p = (const uint8_t *)memchr(p, '\0', last - p)) != 0; ++p )
+	{
+		if ( p[1] == '\0' )
+		{
+			end = p + 1 - env.data;
+			break;
+		}
+	}
+
+	// decodeNandRs() hashed the corrected pages
+	Crc crc;
+
+	crc.i = copy.crc;
+
+	if ( memcmp(crc.b, env.data, sizeof(crc.b)) != 0 )
+	{
+		ostringstream err;
+		err << "decodeEnv: environment checksum mismatch";
+
+		if ( redundOffset )
+			err << " at 0x" << hex << copy.offset;
+
+		copy.error = err.str() + ".";
+		return false;
+	}
+
+	if ( header > sizeof(uint32_t) )
+		copy.flags = env[4];
+
+	copy.vars = ByteSpan(env.data + header, end - header);
+	copy.valid = true;
+	return true;
+}
+
+bool sameEnv(ByteSpan env, ByteSpan other)
+{
+	const size_t header = envHeader();
+
+	return memcmp(env.data, other.data, sizeof(uint32_t)) == 0
+			&& memcmp(env.data + header, other.data + header, env.size - header) == 0;
+}
+
+/*
+ * Spread the env at the start of the image over the pages and fill in the
+ * OOB
+ */
+void encodeNandRs(NandImage &image)
+{
+	withGeometry([&](const auto &g) { encodePages(g, image.bytes()); });
+}
+
+/*
+ * ECC check and correct the blocks of 'pages' raw pages in place, result[]
+ * gets the verify_data_rs() result of every block.  Returns the number of
+ * uncorrectable blocks.
+ */
+int verifyPages(uint8_t *raw, unsigned pages, int *result)
+{
+	return withGeometry([&](const auto &g) { return verifyRaw(g, raw, pages, result); });
+}
+
+namespace {
+
+/*
+ * verifyRaw() of pages that are still coming in: a reader thread reads
+ * them about one ECC batch at a time while the workers correct every batch
+ * as soon as its pages are in.  False with the reason in 'error' if a read
+ * fails, the workers stop waiting for pages then.
+ *
+ * For --stats the correction that runs alongside the reads is hidden
+ * behind them, only what is left after the last read is ECC wall time.
+ */
+template <class G>
+bool streamRaw(const G &g, uint8_t *raw, unsigned pages, int *result,
+		const PageReader &read, string &error)
+{
+	const size_t blockCount = pages * g.steps;
+	const unsigned readPages = max(ECC_BATCH / g.steps, 1u);	// pages per read, about one ECC batch
+	vector<uint8_t *> data(blockCount);
+	vector<const uint8_t *> ecc(blockCount);
+
+	blockPointers(g, raw, blockCount, data.data(), ecc.data());
+
+	mutex lock;
+	condition_variable changed;
+	unsigned pagesRead = 0;
+	bool failed = false;
+	optional<PhaseTimer> tail;
+
+	thread reader([&]
+			{
+				string err;
+
+				for ( unsigned i = 0; i < pages; i += readPages )
+				{
+					const unsigned n = min(readPages, pages - i);
+					const bool ok = read(i, n, pageData(g, raw, i), err);
+
+					{
+						lock_guard<mutex> l(lock);
+
+						if ( ok )
+							pagesRead = i + n;
+						else
+						{
+							failed = true;
+							error = err;
+						}
+					}
+
+					changed.notify_all();
+
+					if ( ! ok )
+						return;
+				}
+
+				tail.emplace(EccPhase, PhaseTimer::Wall);
+			});
+
+	const rs_codec *codec = rs_codec_get(NULL);
+
+	// a single worker gets all blocks at once, it still goes batch by batch
+	WorkPool(jobCount).run(blockCount, ECC_BATCH,
+			[&](size_t begin, size_t end)
+			{
+				for ( size_t b = begin; b < end; b += ECC_BATCH )
+				{
+					const size_t e = min(b + ECC_BATCH, end);
+
+					{
+						unique_lock<mutex> l(lock);
+						changed.wait(l, [&] { return failed || pagesRead * g.steps >= e; });
+
+						if ( failed )
+							return;
+					}
+
+					PhaseTimer timer(EccPhase, PhaseTimer::Cpu);
+
+					rs_verify_blocks(codec, data.data() + b, ecc.data() + b, e - b, result + b);
+				}
+			});
+
+	reader.join();
+	tail.reset();
+	return ! failed;
+}
+
+/*
+ * Correct the raw pages of a copy and compact the page data to the front,
+ * that is the env.  The OOB is overwritten.  With a reader the pages are
+ * read while they are corrected (streamRaw()).  copy.crc gets the crc of
+ * the corrected env behind the header, zero pages (the padding) are only
+ * extended over.
+ */
+template <class G>
+bool decodeRaw(const G &g, uint8_t *raw, EnvCopy &copy, const PageReader &read)
+{
+	const unsigned pages = nandLayout.envPages();
+	vector<int> result(pages * g.steps);
+
+	if ( ! read )
+		verifyRaw(g, raw, pages, result.data());
+	else if ( ! streamRaw(g, raw, pages, result.data(), read, copy.error) )
+		return false;
+
+	if ( statsEnabled )
+	{
+		for ( int r : result )
+		{
+			addCount(r < 0 ? FailedBlocks : r ? CorrectedBlocks : CleanBlocks, 1);
+			addCount(CorrectedSymbols, max(r, 0));
+		}
+	}
+
+	// report the first failure in block order
+	vector<int>::iterator failed = find_if(result.begin(), result.end(),
+			[](int r) { return r < 0; });
+
+	if ( failed != result.end() )
+	{
+		size_t i = failed - result.begin();
+		ostringstream err;
+
+		err << "decodeNandRs(): too many errors in block #" << i % g.steps
+				<< " of chunk #" << i / g.steps;
+
+		if ( redundOffset )
+			err << " at 0x" << hex << copy.offset;
+
+		copy.error = err.str();
+		return false;
+	}
+
+	copy.corrected = count_if(result.begin(), result.end(), [](int r) { return r > 0; });
+	copy.clean = copy.corrected == 0;
+
+	{
+		PhaseTimer timer(CrcPhase);
+		uint32_t crc = 0;
+
+		for ( unsigned i = 0; i < pages; ++i )
+		{
+			const size_t skip = i ? 0 : envHeader();
+			const uint8_t *p = pageData(g, raw, i) + skip;
+			const size_t n = g.pageSize - skip;
+
+			crc = allZero(p, n) ? crc32Zeros(crc, n) : crc32(crc, p, n);
+		}
+
+		copy.crc = crc;
+	}
+
+	for ( unsigned i = 1; i < pages; ++i )
+		memmove(raw + i * g.pageSize, pageData(g, raw, i), g.pageSize);
+
+	copy.env = ByteSpan(raw, nandLayout.envSize);
+	return true;
+}
+
+}; // anonymous namespace
+
+bool decodeNandRs(uint8_t *raw, EnvCopy &copy, const PageReader &read)
+{
+	return withGeometry([&](const auto &g) { return decodeRaw(g, raw, copy, read); });
+}
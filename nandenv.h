@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ * Copyright (C) 2010 Federico Heinz <fheinz@vialibre.org.ar>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef NANDENV_H
+#define NANDENV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cassert>
+#include <istream>
+#include <string>
+#include <vector>
+#include <functional>
+#include "ecc_rs.h"
+
+/*
+ * The u-boot env and its raw nand image: building and checking the env,
+ * and the Reed-Solomon ECC of its pages.  Nothing here touches a device,
+ * plugenv reads and writes the images.
+ */
+
+#define ECC_CHUNK_SIZE  512
+#define ECC_BATCH 16 // blocks per worker grab, a whole syndrome kernel batch
+
+union Crc
+{
+	uint32_t i;
+	uint8_t b[4];
+};
+
+/*
+ * Where the env and its ECC are on the nand.  Every ECC_CHUNK_SIZE step of
+ * a page has ECC_SIZE bytes of ECC, those of a page follow each other in
+ * its OOB from eccOffset on.  The default is the SheevaPlug: 2K pages with
+ * 64 bytes of OOB (24 bytes filler, then 4x10 bytes ECC), 128K eraseblocks
+ * and a 128K env at 0xa0000.
+ */
+struct NandLayout
+{
+	uint32_t pageSize;	// data bytes of a page
+	uint32_t oobSize;
+	uint32_t eccOffset;	// of the ECC of the first step in the OOB
+	uint32_t blockSize;	// eraseblock
+	uint32_t envOffset;
+	uint32_t envSize;
+
+	unsigned steps() const { return pageSize / ECC_CHUNK_SIZE; }
+	unsigned envPages() const { return envSize / pageSize; }
+	unsigned envBlocks() const { return envSize / ECC_CHUNK_SIZE; }
+	size_t rawPageSize() const { return pageSize + oobSize; }
+	size_t rawEnvSize() const { return envPages() * rawPageSize(); }
+	size_t rawBlockSize() const { return blockSize / pageSize * rawPageSize(); }
+
+	// offsets of the data and the ECC of 512 byte block b in the raw pages
+	size_t blockData(size_t b) const
+	{
+		return b / steps() * rawPageSize() + b % steps() * ECC_CHUNK_SIZE;
+	}
+
+	size_t blockEcc(size_t b) const
+	{
+		return b / steps() * rawPageSize() + pageSize + eccOffset + b % steps() * ECC_SIZE;
+	}
+
+	// where the ECC of the steps starts if the OOB ends with it, 0 if it
+	// doesn't fit
+	uint32_t eccAtEnd() const
+	{
+		return oobSize > steps() * ECC_SIZE ? oobSize - steps() * ECC_SIZE : 0;
+	}
+};
+
+extern NandLayout nandLayout;
+
+// what is wrong with the layout (or the redundant offset), empty if nothing
+std::string checkLayout(const NandLayout &layout);
+
+/*
+ * The env in raw nand layout: its pages, each followed by its OOB, the
+ * layout MtdDevice transfers.  This is the only buffer the env ever lives
+ * in: it is read and ECC corrected in place, then the page data is
+ * compacted to the front to form the plain env; writing goes the other way.
+ * The size comes from nandLayout, which must be final when it is created.
+ */
+class NandImage
+{
+public:
+	NandImage() : raw_(nandLayout.rawEnvSize()) {}
+
+	// a layout changed after the buffer was made would run past its end
+	uint8_t *bytes() { assert(raw_.size() >= nandLayout.rawEnvSize()); return raw_.data(); }
+	const uint8_t *bytes() const { assert(raw_.size() >= nandLayout.rawEnvSize()); return raw_.data(); }
+	size_t size() const { assert(raw_.size() >= nandLayout.rawEnvSize()); return raw_.size(); }
+
+private:
+	std::vector<uint8_t> raw_;
+};
+
+// non-owning view of a byte range
+template <class T>
+struct Span
+{
+	T *data;
+	size_t size;
+
+	Span(T *d = 0, size_t n = 0) : data(d), size(n) {}
+
+	T *begin() const { return data; }
+	T *end() const { return data + size; }
+	T &operator[](size_t i) const { return data[i]; }
+};
+
+typedef Span<uint8_t> ByteSpan;
+typedef Span<const char> TextSpan;
+
+// one env copy as found on flash
+struct EnvCopy
+{
+	uint32_t offset;
+	bool valid;		// ECC and crc check out
+	bool clean;		// no ECC correction was needed
+	unsigned corrected;	// blocks the ECC corrected (bitflips for the driver's ECC)
+	uint8_t flags;		// serial of a redundant copy
+	ByteSpan env;		// the whole env, in the image it was read into
+	ByteSpan vars;		// its variables
+	uint32_t crc;		// of the env behind the header, set by decodeNandRs()
+	std::string error;	// why it isn't valid
+
+	explicit EnvCopy(uint32_t o = 0) : offset(o), valid(false), clean(false), corrected(0), flags(0), crc(0) {}
+};
+
+// reads 'pages' raw pages of a copy to 'raw', starting with page 'first';
+// false with the reason in 'error' if that fails
+typedef std::function<bool(unsigned first, unsigned pages, uint8_t *raw, std::string &error)> PageReader;
+
+extern unsigned jobCount;	// ECC workers, 0: one per cpu
+extern uint32_t redundOffset;	// offset of the second env copy, 0: none
+
+// crc, plus the serial of a redundant copy
+size_t envHeader();
+
+/*
+ * Build the env (header followed by the NUL terminated variables, zero
+ * padded to the env size) at the start of the image, returns the env.  The
+ * serial of a redundant env is left 0.
+ */
+ByteSpan encodeEnv(std::istream &in, NandImage &image);
+
+// add a variable (n bytes, without the NUL) at env[len]
+void appendVar(ByteSpan env, size_t &len, const char *var, size_t n);
+
+// zero the serial and the padding behind the variables and set the crc
+void sealEnv(ByteSpan env, size_t len);
+
+// the variables of a decoded env as text, one per line (in place)
+TextSpan decodeEnvText(ByteSpan vars);
+
+// crc of a plain env behind its header, for copy.crc of an env without ECC
+uint32_t envCrc(ByteSpan env);
+
+// check the crc of a copy decoded by decodeNandRs() and find its variables
+bool decodeEnv(EnvCopy &copy);
+
+// same crc and variables, the serial of a redundant env doesn't count
+bool sameEnv(ByteSpan env, ByteSpan other);
+
+// spread the env at the start of the image over the pages and add the ECC
+void encodeNandRs(NandImage &image);
+
+// correct the raw pages of a copy into its env
+bool decodeNandRs(uint8_t *raw, EnvCopy &copy, const PageReader &read = PageReader());
+
+// ECC check and correct raw pages in place, returns the uncorrectable blocks
+int verifyPages(uint8_t *raw, unsigned pages, int *result);
+
+#endif
@@ -6,71 +6,183 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
 #include <cstring>
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <algorithm>
-#include "ecc_rs.h"
+#include <memory>
+#include <vector>
+#include "crc32.h"
+#include "environment.h"
+#include "imagefile.h"
+#include "mtd.h"
+#include "nandenv.h"
+#include "stats.h"
+#include "workpool.h"
 
 using namespace std;
 
 namespace {
 const char programVersion[] = "plugenv version 1.1";
 
+enum Source { MtdSource, ImageSource, EnvBinSource } source(MtdSource); // --image, --env-bin
+string cacheDir; // --cache, empty: no decoded env cache
+bool hwEcc; // --hw-ecc
+const char defaultCacheDir[] = "/run/plugenv";
+
 void usage(const string &progname)
 {
-	cout << "Usage: " << progname << " -e|-h|-l|-v|-w envFile" << endl;
+	cout << "Usage: " << progname << " [-j jobs] [-m mtdDev|--image file|--env-bin file] [-r offset]" << endl;
+	cout << "               [--layout file] [--cache[=dir]] [--hw-ecc] [--stats[=file]]" << endl;
+	cout << "               -e|-h|-l|-v|-w envFile" << endl;
+	cout << "       " << progname << " [-j jobs] [-m mtdDev|--image file|--env-bin file] [-r offset]" << endl;
+	cout << "               [--layout file] [--cache[=dir]] [--hw-ecc] [-g name...] [-s name=value...]" << endl;
+	cout << "               [-d name...] [--script file] [--stats[=file]]" << endl;
+	cout << "       " << progname << " [-j jobs] [-r offset] [--layout file] --fleet dir|manifest" << endl;
+	cout << "               [--golden envFile] [--stats[=file]]" << endl;
+	cout << " --cache[=dir]: reuse the env decoded by an earlier read while the nand" << endl;
+	cout << "               holds the same env (default dir " << defaultCacheDir << ")" << endl;
+	cout << " -d, --delete: delete variables" << endl;
 	cout << " -e: edit and write env" << endl;
+	cout << " --fleet: check every raw nand dump in dir (or listed in manifest, one per" << endl;
+	cout << "          line) on all cpus, one JSON report line per dump" << endl;
+	cout << " -g, --get: print variables" << endl;
+	cout << " --golden: report how the variables of every --fleet dump differ from envFile" << endl;
 	cout << " -h: help" << endl;
+	cout << " --hw-ecc: read the env through the nand driver's ECC, the RS ECC is only" << endl;
+	cout << "           used if the driver's ECC counters report a failure" << endl;
+	cout << " -j: ECC worker threads (default: one per cpu)" << endl;
 	cout << " -l: list env" << endl;
+	cout << " --layout: nand and env layout (page-size, oob-size, ecc-offset, block-size," << endl;
+	cout << "           env-offset, env-size; one \"name value\" per line), the mtd device" << endl;
+	cout << "           gives the page, oob and block sizes (default: SheevaPlug)" << endl;
+	cout << " -m: use mtdDev instead of the u-boot partition in /proc/mtd" << endl;
+	cout << " -r: redundant env, second copy at offset (CONFIG_ENV_OFFSET_REDUND)" << endl;
+	cout << " -s, --set: set variables, an empty value deletes" << endl;
+	cout << " --script: read get/set/delete commands from file, one per line; names" << endl;
+	cout << "           after it are an error, they only continue a -g, -s or -d" << endl;
+	cout << " --stats: at exit print wall and cpu time per phase, ECC counters, bytes" << endl;
+	cout << "          read and written and peak RSS as one JSON line to stderr (or file)" << endl;
 	cout << " -v: version" << endl;
 	cout << " -w: write envFile to nand" << endl;
+	cout << " --image: use a raw nand dump (pages with oob, the whole partition or just" << endl;
+	cout << "          the env block) instead of the mtd device, created when writing" << endl;
+	cout << " --env-bin: use a plain env image file instead of the mtd device" << endl;
+	cout << "get, set and delete run in the given order on the env in memory, any" << endl;
+	cout << "changes are written once at the end" << endl;
 	exit(0);
 }
 
-#define NAND_CHUNK_SIZE 2048
-#define NAND_CHUNK_COUNT 64
-#define ENV_SIZE (NAND_CHUNK_COUNT*NAND_CHUNK_SIZE) // 128K
-#define ECC_CHUNK_SIZE  512
-#define ECC_SIZE 10
+// one -g/-s/-d or script command
+struct EnvOp
+{
+	enum Kind { Get, Set, Delete } kind;
+	string arg;		// name, or name=value for Set
+
+	EnvOp(Kind k, const string &a) : kind(k), arg(a) {}
+};
 
-union Oob
+// a --layout setting
+struct LayoutKey
 {
-	uint8_t b[64];
-	struct oob_data_s
-	{
-		unsigned char filler[24];
-		unsigned char ecc_buffers[4][ECC_SIZE];
-	} data;
+	const char *name;
+	uint32_t NandLayout::*field;
+	bool device;		// MEMGETINFO has it
 };
 
-union Crc
+const LayoutKey layoutKeys[] =
 {
-	uint32_t i;
-	uint8_t b[4];
+	{ "page-size", &NandLayout::pageSize, true },
+	{ "oob-size", &NandLayout::oobSize, true },
+	{ "ecc-offset", &NandLayout::eccOffset, false },
+	{ "block-size", &NandLayout::blockSize, true },
+	{ "env-offset", &NandLayout::envOffset, false },
+	{ "env-size", &NandLayout::envSize, false },
 };
 
-typedef basic_string<uint8_t> u8string;
+unsigned layoutGiven;	// bit per layoutKeys entry set by --layout
+const unsigned eccOffsetGiven = 1 << 2;
+
+// the --fleet report of one dump
+struct DumpReport
+{
+	string line;		// JSON
+	bool valid;		// a copy decoded
+	bool corrected;		// the copy in use needed ECC correction
+	size_t deviations;	// from the golden env
 
-string validateSystem(const string &progname);
+	DumpReport() : valid(false), corrected(false), deviations(0) {}
+};
+
+// what the nand looked like when a cached env was decoded
+struct CacheKey
+{
+	uint32_t envOffset;
+	uint32_t redundOffset;
+	uint32_t firstPage[2];	// crc of the raw first page (data and oob) of each copy
+	mtd_ecc_stats stats;
+};
+
+// a cache file is this header followed by the variables
+struct CacheHeader
+{
+	char magic[8];
+	CacheKey key;
+	uint32_t offset;	// of the copy
+	uint8_t crc[4];
+	uint8_t flags;
+	uint8_t clean;
+	uint16_t pad;
+	uint32_t size;		// of the variables
+};
+
+string validateSystem(const string &progname, const string &mtdDev);
 void list(const string &mtdDev);
 void edit(const string &mtdDev);
 void write(const string &mtdDev, const string &envFile);
-string getEnvString(const string &mtdDev);
-u8string getOutput(string cmd);
-string getOutputString(string cmd);
-u8string encodeEnv(ifstream *);
-string decodeEnvText(u8string env);
-u8string decodeEnv(u8string env);
-u8string encodeNandRs(u8string env);
-u8string decodeNandRs(u8string nandRs);
-uint32_t crc32(const u8string &);
-uint32_t crc32(uint32_t crc, const uint8_t *buf, unsigned int len);
+void batch(const string &mtdDev, const vector<EnvOp> &ops);
+void readScript(const string &progname, const string &file, vector<EnvOp> &ops);
+void readLayout(const string &progname, const string &file);
+void detectLayout(MtdDevice &mtd, const string &mtdDev);
+void useLayout(const string &what);
+bool fleet(const string &list, const string &goldenFile);
+vector<string> fleetDumps(const string &list);
+DumpReport checkDump(const string &file, const Environment *golden);
+string dumpProblem(const string &file);
+string jsonString(string_view s);
+unique_ptr<NandDevice> openDevice(const string &mtdDev, bool writable);
+void mapEnvBlocks(ImageFile &image, const string &file);
+EnvCopy readCurrent(NandDevice *mtd, const string &mtdDev, NandImage &image, bool cached);
+void store(NandDevice *mtd, const string &mtdDev, ByteSpan env, const EnvCopy &current);
+void commit(NandDevice &mtd, const string &mtdDev, ByteSpan env, const EnvCopy &current);
+EnvCopy readEnvBin(const string &file);
+void commitEnvBin(const string &file, ByteSpan env, const EnvCopy &current);
+NandImage &imageBuffer();
+TextSpan getEnvText(const string &mtdDev, unique_ptr<NandDevice> &mtd);
+EnvCopy readEnv(NandDevice &mtd, NandImage &image);
+EnvCopy readEnvCached(NandDevice &mtd, const string &mtdDev, NandImage &image);
+string cacheFile(const string &mtdDev);
+CacheKey cacheKey(NandDevice &mtd);
+bool loadCache(const string &file, const CacheKey &key, NandImage &image, EnvCopy &copy);
+void storeCache(const string &file, const CacheKey &key, const EnvCopy &copy);
+bool readEnvCopy(NandDevice &mtd, NandImage &image, EnvCopy &copy);
+bool readRaw(NandDevice &mtd, uint32_t offset, unsigned pages, uint8_t *buf, string &error);
+bool readHwEcc(NandDevice &mtd, NandImage &image, EnvCopy &copy);
+bool readHw(NandDevice &mtd, uint32_t offset, unsigned pages, uint8_t *buf, mtd_ecc_stats &delta);
+bool peekFlags(NandDevice &mtd, uint32_t offset, uint8_t &flags);
+bool redundNewer(uint8_t flags, uint8_t redundFlags);
 
 }; // anonymous namespace
 
@@ -82,12 +194,91 @@ int main(int argc, char *argv[])
 	bool ls(false);
 	bool wr(false);
 	string envFile;
-
+	string mtdDev;
+	string fleetList;
+	string goldenFile;
+	string layoutFile;
+	vector<EnvOp> ops;
+	EnvOp::Kind opKind(EnvOp::Get);
+	bool opSeen(false);
+	bool operands(false);	// operands continue the last -g/-s/-d
+
+	static const option longOpts[] =
+	{
+		{ "cache", optional_argument, 0, 'C' },
+		{ "delete", required_argument, 0, 'd' },
+		{ "env-bin", required_argument, 0, 'B' },
+		{ "fleet", required_argument, 0, 'F' },
+		{ "get", required_argument, 0, 'g' },
+		{ "golden", required_argument, 0, 'G' },
+		{ "hw-ecc", no_argument, 0, 'E' },
+		{ "image", required_argument, 0, 'I' },
+		{ "layout", required_argument, 0, 'L' },
+		{ "script", required_argument, 0, 'S' },
+		{ "set", required_argument, 0, 's' },
+		{ "stats", optional_argument, 0, 'T' },
+		{ 0, 0, 0, 0 }
+	};
+
+	// a leading '-' returns operands in place (as 1), they continue the
+	// last -g/-s/-d unless a --script came after it
 	int c;
-	while ((c = getopt(argc, argv, "ehlvw:")) != -1)
+	while ((c = getopt_long(argc, argv, "-d:eg:hj:lm:r:s:vw:", longOpts, 0)) != -1)
 	{
 		switch(c)
 		{
+			case 'd':
+			case 'g':
+			case 's':
+				opKind = c == 'g' ? EnvOp::Get : c == 's' ? EnvOp::Set : EnvOp::Delete;
+				ops.push_back(EnvOp(opKind, optarg));
+				opSeen = true;
+				operands = true;
+				break;
+			case 1:
+				if ( ops.empty() )
+					usage(progname);
+
+				if ( ! operands )
+				{
+					cerr << progname << ": '" << optarg << "' follows --script, names only continue -g, -s or -d" << endl;
+					exit(1);
+				}
+
+				ops.push_back(EnvOp(opKind, optarg));
+				break;
+			case 'B':
+			case 'I':
+				if ( source != MtdSource || ! mtdDev.empty() )
+					usage(progname);
+
+				source = c == 'I' ? ImageSource : EnvBinSource;
+				mtdDev = optarg;
+				break;
+			case 'C':
+				cacheDir = optarg ? optarg : defaultCacheDir;
+				break;
+			case 'E':
+				hwEcc = true;
+				break;
+			case 'F':
+				fleetList = optarg;
+				++optCount;
+				break;
+			case 'G':
+				goldenFile = optarg;
+				break;
+			case 'L':
+				layoutFile = optarg;
+				break;
+			case 'S':
+				readScript(progname, optarg, ops);
+				opSeen = true;
+				operands = false;
+				break;
+			case 'T':
+				enableStats(optarg ? optarg : "");
+				break;
 			case 'e':
 				ed = true;
 				++optCount;
@@ -95,10 +286,44 @@ int main(int argc, char *argv[])
 			case 'h':
 				usage(progname);
 				break;
+			case 'j':
+			{
+				char *end;
+				unsigned long n = strtoul(optarg, &end, 10);
+
+				if ( *end != '\0' || n < 1 || n > 1024 )
+				{
+					cerr << progname << ": invalid job count '" << optarg << "'" << endl;
+					exit(1);
+				}
+
+				jobCount = n;
+				break;
+			}
 			case 'l':
 				ls = true;
 				++optCount;
 				break;
+			case 'm':
+				if ( source != MtdSource )
+					usage(progname);
+
+				mtdDev = optarg;
+				break;
+			case 'r':
+			{
+				char *end;
+				unsigned long n = strtoul(optarg, &end, 0);
+
+				if ( *end != '\0' || n > 0xffffffffUL )
+				{
+					cerr << progname << ": invalid redundant env offset '" << optarg << "'" << endl;
+					exit(1);
+				}
+
+				redundOffset = n;
+				break;
+			}
 			case 'v':
 				cout << programVersion << endl;
 				exit(1);
@@ -114,12 +339,46 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if ( optCount != 1 )
+	if ( opSeen )
+		++optCount;
+
+	if ( optCount != 1 || (! goldenFile.empty() && fleetList.empty()) )
 		usage(progname);
 
-	string mtdDev(validateSystem(progname));
+	if ( ! layoutFile.empty() )
+		readLayout(progname, layoutFile);
+
+	// the layout of an mtd device is completed when it is opened
+	if ( source != MtdSource || ! fleetList.empty() )
+		useLayout(progname);
 
-	if ( wr )
+	// dumps work on any machine, they don't come from the nand
+	if ( ! fleetList.empty() )
+	{
+		if ( source != MtdSource || ! mtdDev.empty() )
+			usage(progname);
+
+		statsContext("\"command\":\"fleet\",\"device\":" + jsonString(fleetList));
+		return fleet(fleetList, goldenFile) ? 0 : 1;
+	}
+
+	// image files need neither the plug nor root, nor a cache
+	if ( source == MtdSource )
+	{
+		PhaseTimer timer(ValidatePhase);
+		mtdDev = validateSystem(progname, mtdDev);
+	}
+	else
+		cacheDir.clear();
+
+	const char *const sourceNames[] = { "mtd", "image", "env-bin" };
+
+	statsContext(string("\"command\":\"") + (opSeen ? "batch" : wr ? "write" : ed ? "edit" : "list")
+			+ "\",\"source\":\"" + sourceNames[source] + "\",\"device\":" + jsonString(mtdDev));
+
+	if ( opSeen )
+		batch(mtdDev, ops);
+	else if ( wr )
 		write(mtdDev, envFile);
 	else if ( ed )
 		edit(mtdDev);
@@ -131,8 +390,20 @@ int main(int argc, char *argv[])
 
 namespace {
 
-string validateSystem(const string &progname)
+string validateSystem(const string &progname, const string &mtdDevOpt)
 {
+	if ( ! mtdDevOpt.empty() )
+	{
+		// an explicit device (e.g. nandsim) skips the plug detection
+		if ( geteuid() != 0 )
+		{
+			cerr << progname << ": you must be root to run this program" << endl;
+			exit(1);
+		}
+
+		return mtdDevOpt;
+	}
+
 	bool foundSheeva = false;
 	string mtdDev;
 
@@ -199,18 +470,21 @@ string validateSystem(const string &progname)
 
 void list(const string &mtdDev)
 {
-	cout << getEnvString(mtdDev);
+	unique_ptr<NandDevice> mtd;
+	TextSpan text(getEnvText(mtdDev, mtd));
+
+	cout.write(text.data, text.size);
 }
 
 void edit(const string &mtdDev)
 {
-	string envStr(getEnvString(mtdDev));
-
 	string tmpFilEnv("/tmp/UBoot-Env.env");
 
 	{
+		unique_ptr<NandDevice> mtd;
+		TextSpan text(getEnvText(mtdDev, mtd));
 		ofstream viTemp(tmpFilEnv.c_str());
-		viTemp << envStr;
+		viTemp.write(text.data, text.size);
 	}
 
 	struct stat stEnv1;
@@ -232,388 +506,1081 @@ void edit(const string &mtdDev)
 		write(mtdDev, tmpFilEnv);
 }
 
-string getWriteCmd(const string &mtdDev, const string &filename)
+void write(const string &mtdDev, const string &envFile)
 {
-	string nd(getOutputString("nandwrite --version"));
-	int v1(atoi(nd.substr(10, 1).c_str()));
-	int v2(atoi(nd.substr(12, 1).c_str()));
-	int v3(atoi(nd.substr(14, 1).c_str()));
-
-	string cmd("nandwrite ");
+	// the device completes the layout the image buffer is made for
+	unique_ptr<NandDevice> mtd(openDevice(mtdDev, true));
+	ByteSpan env;
 
-	if ( (v1 < 1) || (v2 < 4) ||  (v3 < 7) )
-		cmd += "-f ";
+	{
+		PhaseTimer timer(EncodePhase);
+		ifstream in(envFile.c_str());
+		env = encodeEnv(in, imageBuffer());
+	}
 
-	cmd += "-n -o -s 0xa0000 " + mtdDev + " " + filename;
+	unique_ptr<NandImage> flash(new NandImage);
 
-	return cmd;
+	store(mtd.get(), mtdDev, env, readCurrent(mtd.get(), mtdDev, *flash, false));
 }
 
-void write(const string &mtdDev, const string &envFile)
+/*
+ * Run the get/set/delete commands in order on the env read from nand,
+ * the changes (if any) are committed with one write
+ */
+void batch(const string &mtdDev, const vector<EnvOp> &ops)
 {
-	string tmpFilNand("/tmp/UBoot-Env.nand");
-	u8string env;
+	bool changes(false);
+
+	for ( size_t i = 0; i < ops.size(); ++i )
+		changes = changes || ops[i].kind != EnvOp::Get;
 
+	unique_ptr<NandDevice> mtd(openDevice(mtdDev, changes));
+	unique_ptr<NandImage> flash(new NandImage);
+	EnvCopy current(readCurrent(mtd.get(), mtdDev, *flash, ! changes));
+
+	if ( ! current.valid )
 	{
-		ifstream in(envFile.c_str());
-		env = encodeEnv(&in);
+		cerr << current.error << endl;
+		exit(1);
 	}
 
-	u8string nandRs(encodeNandRs(env));
+	Environment vars;
 
-	if ( env != decodeNandRs(nandRs) )
 	{
-		cerr << "encodeEnv->encodeNandRs->decodeNandRs fails" << endl;
+		PhaseTimer timer(ParsePhase);
+		vars.load(current.vars.data, current.vars.size);
+	}
+
+	for ( size_t i = 0; i < ops.size(); ++i )
+	{
+		const EnvOp &op(ops[i]);
+		string_view arg(op.arg);
+		string_view name(arg.substr(0, arg.find('=')));
+
+		if ( name.empty() || (op.kind != EnvOp::Set && name.size() != arg.size()) )
+		{
+			cerr << "invalid variable '" << op.arg << "' aborting!" << endl;
+			exit(1);
+		}
+
+		string_view value(name.size() < arg.size() ? arg.substr(name.size() + 1) : string_view());
+
+		if ( op.kind == EnvOp::Get )
+		{
+			if ( ! vars.get(name, value) )
+			{
+				cerr << "## Error: \"" << name << "\" not defined" << endl;
+				exit(1);
+			}
+
+			cout << name << "=" << value << endl;
+		}
+		else if ( value.empty() )
+			vars.erase(name);
+		else
+			vars.set(name, value);
+	}
+
+	if ( ! changes )
+		return;
+
+	// the new env: changed variables stay in place, new ones go last
+	ByteSpan env(imageBuffer().bytes(), nandLayout.envSize);
+	size_t len = envHeader();
+
+	if ( len + vars.bytes() > env.size - 1 )
+	{
+		cerr << "environment size exceeded, aborting!" << endl;
 		exit(1);
 	}
 
 	{
-		ofstream out(tmpFilNand.c_str());
-		out.write((const char*)nandRs.data(), nandRs.length());
+		PhaseTimer timer(EncodePhase);
+
+		vars.serialize(env.data + len);
+		len += vars.bytes();
+		sealEnv(env, len);
+	}
+
+	store(mtd.get(), mtdDev, env, current);
+}
+
+/*
+ * Commands, one per line: "get name", "set name=value" or "delete name";
+ * empty lines and lines starting with '#' are ignored
+ */
+void readScript(const string &progname, const string &file, vector<EnvOp> &ops)
+{
+	ifstream in(file.c_str());
+
+	if ( ! in )
+	{
+		cerr << progname << ": unable to read script " << file << endl;
+		exit(1);
 	}
 
-	string eraseCmd = "flash_erase " + mtdDev + " 0xa0000 1";
-	string writeCmd(getWriteCmd(mtdDev, tmpFilNand));
+	string line;
 
-	cout << eraseCmd << endl;
-	cout << getOutputString(eraseCmd) << endl;
-	cout << writeCmd << endl;
-	cout << getOutputString(writeCmd) << endl;
+	for ( unsigned lineNum = 1; getline(in, line); ++lineNum )
+	{
+		size_t start = line.find_first_not_of(" \t");
+
+		if ( start == string::npos || line[start] == '#' )
+			continue;
+
+		size_t end = line.find_first_of(" \t", start);
+		string cmd(line.substr(start, end - start));
+		size_t argStart = end == string::npos ? end : line.find_first_not_of(" \t", end);
+		string arg(argStart == string::npos ? string() : line.substr(argStart));
+
+		if ( cmd == "get" )
+			ops.push_back(EnvOp(EnvOp::Get, arg));
+		else if ( cmd == "set" )
+			ops.push_back(EnvOp(EnvOp::Set, arg));
+		else if ( cmd == "delete" )
+			ops.push_back(EnvOp(EnvOp::Delete, arg));
+		else
+		{
+			cerr << file << ":" << lineNum << ": unknown command '" << cmd << "'" << endl;
+			exit(1);
+		}
+	}
 }
 
-string getEnvString(const string &mtdDev)
+/*
+ * Settings of nandLayout, one "name value" per line (the value in C
+ * notation, e.g. 0xa0000); empty lines and lines starting with '#' are
+ * ignored.  Without ecc-offset the ECC is at the end of the oob.
+ */
+void readLayout(const string &progname, const string &file)
 {
-	string verS(getOutputString("nanddump --version").substr(9, 4));
-	float ver(atof(verS.c_str()));
-	string cmd;
+	ifstream in(file.c_str());
 
-	if ( ver > 1.30 )
-		cmd = "nanddump -q --bb=padbad --oob -n -s 0xa0000 -l 0x20000 " + mtdDev;
-	else
-		cmd = "nanddump -q -n -s 0xa0000 -l 0x20000 " + mtdDev;
+	if ( ! in )
+	{
+		cerr << progname << ": unable to read layout " << file << endl;
+		exit(1);
+	}
+
+	string line;
 
-	u8string s(getOutput(cmd));
-	return decodeEnvText(decodeNandRs(s));
+	for ( unsigned lineNum = 1; getline(in, line); ++lineNum )
+	{
+		istringstream fields(line);
+		string name, value, rest;
+
+		if ( ! (fields >> name) || name[0] == '#' )
+			continue;
+
+		const size_t keys = sizeof(layoutKeys) / sizeof(layoutKeys[0]);
+		size_t k = 0;
+
+		while ( k < keys && name != layoutKeys[k].name )
+			++k;
+
+		char *end = 0;
+		unsigned long n = 0;
+
+		if ( fields >> value )
+			n = strtoul(value.c_str(), &end, 0);
+
+		if ( k == keys || ! end || *end != '\0' || n > 0xffffffffUL || fields >> rest )
+		{
+			cerr << file << ":" << lineNum << ": invalid layout setting '" << line << "'" << endl;
+			exit(1);
+		}
+
+		nandLayout.*layoutKeys[k].field = n;
+		layoutGiven |= 1 << k;
+	}
+
+	if ( ! (layoutGiven & eccOffsetGiven) )
+		nandLayout.eccOffset = nandLayout.eccAtEnd();
 }
 
-u8string getOutput(string cmd)
+/*
+ * The page, oob and eraseblock sizes of an mtd device, a --layout file
+ * must agree with them.  Unless the file gives it, the ECC is where the
+ * kernel's ECC layout has ECC_SIZE bytes per step in a row, or else at the
+ * end of the oob.
+ */
+void detectLayout(MtdDevice &mtd, const string &mtdDev)
 {
-	u8string data;
-	uint8_t buf[2048];
+	const mtd_info_user &info(mtd.info());
+	const uint32_t device[] = { info.writesize, info.oobsize, 0, info.erasesize };
+
+	for ( size_t k = 0; k < sizeof(device) / sizeof(device[0]); ++k )
+	{
+		if ( ! layoutKeys[k].device )
+			continue;
+
+		if ( layoutGiven & 1 << k && nandLayout.*layoutKeys[k].field != device[k] )
+		{
+			cerr << "detectLayout(): " << mtdDev << " has a " << layoutKeys[k].name
+					<< " of " << device[k] << ", not " << nandLayout.*layoutKeys[k].field << endl;
+			exit(1);
+		}
+
+		nandLayout.*layoutKeys[k].field = device[k];
+	}
+
+	if ( ! (layoutGiven & eccOffsetGiven) )
+	{
+		nand_ecclayout_user ecc;
+		const uint32_t eccBytes = nandLayout.steps() * ECC_SIZE;
+
+		nandLayout.eccOffset = nandLayout.eccAtEnd();
 
-	FILE *stream = popen(cmd.c_str(), "r");
+		// the kernel only reports the first MTD_MAX_ECCPOS_ENTRIES positions
+		if ( mtd.eccLayout(ecc) && ecc.eccbytes == eccBytes )
+		{
+			uint32_t i = 1;
+
+			while ( i < min<uint32_t>(eccBytes, MTD_MAX_ECCPOS_ENTRIES)
+					&& ecc.eccpos[i] == ecc.eccpos[0] + i )
+				++i;
+
+			if ( i == min<uint32_t>(eccBytes, MTD_MAX_ECCPOS_ENTRIES) )
+				nandLayout.eccOffset = ecc.eccpos[0];
+		}
+	}
+
+	useLayout(mtdDev);
+}
+
+// exit unless nandLayout is complete and consistent
+void useLayout(const string &what)
+{
+	string err(checkLayout(nandLayout));
 
-	if ( ! stream )
+	if ( ! err.empty() )
 	{
-		cerr << "getOutput(): failed to run " << cmd << endl;
+		cerr << what << ": " << err << endl;
 		exit(1);
 	}
+}
+
+/*
+ * Decode every dump of the fleet read-only and report each one against
+ * the golden env, in the order of the list.  The dumps are spread over the
+ * -j workers, one dump at a time, and each is decoded on its worker alone;
+ * false if a dump has no valid env.
+ */
+bool fleet(const string &list, const string &goldenFile)
+{
+	vector<string> dumps(fleetDumps(list));
+	Environment golden;
+
+	if ( ! goldenFile.empty() )
+	{
+		ifstream in(goldenFile.c_str());
+
+		if ( ! in )
+		{
+			cerr << "fleet(): unable to read " << goldenFile << endl;
+			exit(1);
+		}
+
+		EnvCopy copy;
+
+		copy.env = encodeEnv(in, imageBuffer());
+		copy.crc = envCrc(copy.env);
+		decodeEnv(copy);
+		golden.load(copy.vars.data, copy.vars.size);
+	}
+
+	vector<DumpReport> reports(dumps.size());
+	const unsigned jobs = jobCount;
+
+	jobCount = 1;
+	WorkPool(jobs).run(dumps.size(), 1,
+			[&](size_t begin, size_t end)
+			{
+				for ( size_t i = begin; i < end; ++i )
+					reports[i] = checkDump(dumps[i], goldenFile.empty() ? 0 : &golden);
+			});
+
+	size_t valid = 0, corrected = 0, deviating = 0;
 
-	while ( ! feof(stream) )
+	for ( size_t i = 0; i < reports.size(); ++i )
 	{
-		size_t n = fread(buf, 1, sizeof(buf), stream);
-		data.append(buf, n);
+		cout << reports[i].line << endl;
+		valid += reports[i].valid;
+		corrected += reports[i].corrected;
+		deviating += reports[i].deviations != 0;
 	}
 
-	pclose(stream);
-	return data;
+	cout << "{\"dumps\":" << dumps.size() << ",\"valid\":" << valid
+			<< ",\"corrected\":" << corrected << ",\"deviating\":" << deviating
+			<< ",\"failed\":" << dumps.size() - valid << "}" << endl;
+
+	return valid == dumps.size();
 }
 
-string getOutputString(string cmd)
+// the files of a directory (sorted), or the lines of a manifest
+vector<string> fleetDumps(const string &list)
 {
-	string data;
-	char buf[2048];
+	vector<string> dumps;
+
+	if ( DIR *dir = opendir(list.c_str()) )
+	{
+		while ( dirent *ent = readdir(dir) )
+		{
+			string file(list + "/" + ent->d_name);
+			struct stat st;
 
-	cmd += " 2>&1";
+			if ( ent->d_name[0] != '.' && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode) )
+				dumps.push_back(file);
+		}
+
+		closedir(dir);
+		sort(dumps.begin(), dumps.end());
+		return dumps;
+	}
 
-	FILE *stream = popen(cmd.c_str(), "r");
+	ifstream in(list.c_str());
 
-	if ( ! stream )
+	if ( ! in )
 	{
-		cerr << "getOutputString(): failed to run " << cmd << endl;
+		cerr << "fleetDumps(): unable to read " << list << endl;
 		exit(1);
 	}
 
-	while ( ! feof(stream) )
+	// empty lines and lines starting with '#' are ignored
+	string line;
+
+	while ( getline(in, line) )
 	{
-		size_t n = fread(buf, 1, sizeof(buf), stream);
-		data.append(buf, n);
+		size_t start = line.find_first_not_of(" \t");
+
+		if ( start != string::npos && line[start] != '#' )
+			dumps.push_back(line.substr(start, line.find_last_not_of(" \t\r") + 1 - start));
 	}
 
-	pclose(stream);
-	return data;
+	return dumps;
 }
 
-u8string encodeEnv(ifstream *ifs)
+/*
+ * Every env copy of a dump (as written by "nanddump -o" of the partition
+ * or just the env block): whether its ECC and crc check out and how many
+ * blocks needed correction.  The copy u-boot would use is compared with
+ * the golden env: variables it lacks, has with another value or has extra.
+ */
+DumpReport checkDump(const string &file, const Environment *golden)
 {
-	u8string env;
+	DumpReport report;
+	ostringstream out;
+
+	out << "{\"dump\":" << jsonString(file);
+
+	string problem(dumpProblem(file));
+
+	if ( ! problem.empty() )
+	{
+		out << ",\"error\":" << jsonString(problem) << "}";
+		report.line = out.str();
+		return report;
+	}
 
-	while ( *ifs )
+	const NandLayout &l(nandLayout);
+	ImageFile image(file, false, l.pageSize, l.oobSize, l.blockSize / l.pageSize);
+
+	mapEnvBlocks(image, file);
+
+	// only needed if the pages weren't mapped
+	unique_ptr<NandImage> buffer(new NandImage);
+	EnvCopy copies[2] = { EnvCopy(l.envOffset), EnvCopy(redundOffset) };
+	const int count = redundOffset ? 2 : 1;
+	int use = -1;
+
+	out << ",\"copies\":[";
+
+	for ( int i = 0; i < count; ++i )
 	{
-		char buf[512];
-		ifs->getline(buf, sizeof(buf));
+		EnvCopy &copy(copies[i]);
+
+		readEnvCopy(image, *buffer, copy);
+
+		out << (i ? "," : "") << "{\"offset\":\"0x" << hex << copy.offset << dec << "\""
+				<< ",\"ecc\":\"" << (copy.env.data ? "ok" : "failed") << "\""
+				<< ",\"corrected\":" << copy.corrected;
 
-		if ( ifs->gcount() > 4 ) // min valid length 4, i.e "a=c"
+		// decodeNandRs() computed the crc of the corrected env
+		if ( copy.env.data )
 		{
-			u8string s((uint8_t*)buf);
+			Crc crc;
 
-			if ( ! s.find((uint8_t)'=') )
-			{
-				cerr << "invalid env variable assignment: '"
-						<< buf << "' aborting!" << endl;
-				exit(1);
-			}
+			crc.i = copy.crc;
+			out << ",\"crc\":\"" << (memcmp(crc.b, copy.env.data, sizeof(crc.b)) ? "mismatch" : "ok") << "\"";
+		}
+
+		if ( copy.valid && redundOffset )
+			out << ",\"serial\":" << (unsigned)copy.flags;
+
+		if ( ! copy.valid )
+			out << ",\"error\":" << jsonString(copy.error);
+
+		out << "}";
+
+		if ( copy.valid && (use < 0 || redundNewer(copies[use].flags, copy.flags)) )
+			use = i;
+	}
+
+	out << "]";
+
+	if ( use >= 0 )
+	{
+		const EnvCopy &copy(copies[use]);
+
+		report.valid = true;
+		report.corrected = ! copy.clean;
+		out << ",\"env\":\"0x" << hex << copy.offset << dec << "\"";
+	}
+
+	if ( use >= 0 && golden )
+	{
+		Environment vars;
+		string missing, changed, extra;
+		string_view value;
+		const char *sep[] = { "", "," };
+
+		vars.load(copies[use].vars.data, copies[use].vars.size);
+
+		golden->forEach([&](string_view name, string_view goldenValue)
+				{
+					if ( ! vars.get(name, value) )
+						missing += sep[! missing.empty()] + jsonString(name);
+					else if ( value != goldenValue )
+						changed += sep[! changed.empty()] + jsonString(name) + ":" + jsonString(value);
+					else
+						return;
+
+					++report.deviations;
+				});
+
+		vars.forEach([&](string_view name, string_view value)
+				{
+					string_view goldenValue;
+
+					if ( ! golden->get(name, goldenValue) )
+					{
+						extra += sep[! extra.empty()] + jsonString(name) + ":" + jsonString(value);
+						++report.deviations;
+					}
+				});
+
+		out << ",\"missing\":[" << missing << "],\"changed\":{" << changed
+				<< "},\"extra\":{" << extra << "}";
+	}
+
+	out << "}";
+	report.line = out.str();
+	return report;
+}
+
+// why a file can't be a dump of the env blocks, empty if it can
+string dumpProblem(const string &file)
+{
+	const off_t rawBlock = nandLayout.rawBlockSize();
+	struct stat st;
+
+	if ( stat(file.c_str(), &st) != 0 || access(file.c_str(), R_OK) != 0 )
+		return string("unable to read: ") + strerror(errno);
+
+	// the env blocks alone, or the partition up to the last env block
+	const off_t blocks = st.st_size % rawBlock ? 0 : st.st_size / rawBlock;
+	const bool envBlocks = blocks == (redundOffset ? 2 : 1);
+
+	if ( ! envBlocks && blocks <= max(nandLayout.envOffset, redundOffset) / nandLayout.blockSize )
+		return "not a raw dump of the env block or the partition (" + to_string(st.st_size) + " bytes)";
 
-			env += s;
-			env += (uint8_t)'\0';
+	return string();
+}
+
+// a JSON string, the env is taken as bytes: only '"', '\\' and control
+// characters are escaped
+string jsonString(string_view s)
+{
+	string json("\"");
+
+	for ( char c : s )
+	{
+		if ( c == '"' || c == '\\' )
+			json += string("\\") + c;
+		else if ( (unsigned char)c < 0x20 || c == 0x7f )
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+			json += buf;
 		}
+		else
+			json += c;
 	}
 
-	if ( env.length() > (ENV_SIZE - 1 - sizeof(uint32_t)) )
+	return json + "\"";
+}
+
+/*
+ * The mtd device, which completes the layout, or the --image file; none for
+ * an --env-bin file
+ */
+unique_ptr<NandDevice> openDevice(const string &mtdDev, bool writable)
+{
+	PhaseTimer timer(ValidatePhase);
+	const NandLayout &l(nandLayout);
+	unique_ptr<NandDevice> mtd;
+
+	if ( source == MtdSource )
 	{
-		cerr << "environment size exceeded, aborting!" << endl;
-		exit(1);
+		MtdDevice *dev = new MtdDevice(mtdDev, writable);
+
+		mtd.reset(dev);
+		detectLayout(*dev, mtdDev);
 	}
+	else if ( source == ImageSource )
+	{
+		ImageFile *image = new ImageFile(mtdDev, writable, l.pageSize, l.oobSize,
+				l.blockSize / l.pageSize, redundOffset ? 2 : 1);
 
-	env.append(ENV_SIZE - env.length() - sizeof(uint32_t)
-					, (uint8_t)'\0');
+		mtd.reset(image);
+		mapEnvBlocks(*image, mtdDev);
+	}
 
-	Crc crc;
+	return mtd;
+}
 
-	crc.i = crc32(env);
+/*
+ * A dump that doesn't reach the last env block of the partition holds just
+ * the env block, followed by the redundant one with -r; anything else is
+ * refused before a copy is looked for in a block the file doesn't have
+ */
+void mapEnvBlocks(ImageFile &image, const string &file)
+{
+	const NandLayout &l(nandLayout);
+	const size_t blocks = image.info().size / l.blockSize;
+	vector<uint32_t> offsets(1, l.envOffset);
 
-	u8string crcS;
-	crcS += crc.b[0];
-	crcS += crc.b[1];
-	crcS += crc.b[2];
-	crcS += crc.b[3];
+	if ( blocks > max(l.envOffset, redundOffset) / l.blockSize )
+		return;
 
-	env.insert(0, crcS);
+	if ( redundOffset )
+		offsets.push_back(redundOffset);
 
-	if ( env.length() != ENV_SIZE )
+	if ( blocks != offsets.size() )
 	{
-		cerr << "encodeEnv(): incorrect env size, aborting!" << endl;
+		cerr << "mapEnvBlocks(): " << file << " holds " << blocks << (blocks == 1 ? " block" : " blocks");
+
+		if ( blocks < offsets.size() )
+			cerr << ", none for the env at 0x" << hex << offsets[blocks] << dec;
+
+		cerr << "; an image must be the env block" << (redundOffset ? " followed by the redundant one" : "")
+				<< " or the partition up to the last env block" << endl;
 		exit(1);
 	}
 
-	return env;
+	image.setBlocks(offsets);
+}
+
+// the env there is now, read through the cache if 'cached'
+EnvCopy readCurrent(NandDevice *mtd, const string &mtdDev, NandImage &image, bool cached)
+{
+	if ( ! mtd )
+		return readEnvBin(mtdDev);
+
+	return cached ? readEnvCached(*mtd, mtdDev, image) : readEnv(*mtd, image);
 }
 
-string decodeEnvText(u8string env)
+void store(NandDevice *mtd, const string &mtdDev, ByteSpan env, const EnvCopy &current)
 {
-	u8string s(decodeEnv(env));
-	return string((const char*)s.data(), s.length());
+	if ( mtd )
+		commit(*mtd, mtdDev, env, current);
+	else
+		commitEnvBin(mtdDev, env, current);
 }
 
-u8string decodeEnv(u8string env)
+/*
+ * Write the env built at the start of the image buffer, 'current' is what
+ * the nand holds now
+ */
+void commit(NandDevice &mtd, const string &mtdDev, ByteSpan env, const EnvCopy &current)
 {
-	if ( env.length() != ENV_SIZE )
+	NandImage &image(imageBuffer());
+	const unsigned pages = nandLayout.envPages();
+	uint32_t offset(nandLayout.envOffset);
+
+	// leave the nand alone if it already holds this env
+	if ( current.valid && current.clean && sameEnv(env, current.env) )
 	{
-		cerr << "decodeEnv(): incorrect env size, aborting!" << endl;
-		exit(1);
+		cout << mtdDev << " at 0x" << hex << current.offset << dec
+				<< ": unchanged" << endl;
+		return;
 	}
 
-	if ( env[ENV_SIZE-1] != '\0' )
+	// a redundant env goes to the copy not in use with the next serial,
+	// the current copy stays intact until the new one is complete
+	if ( redundOffset )
 	{
-		cerr << "decodeEnv(): environment must be terminated with '\\0'." << endl;
-		exit(1);
+		if ( current.valid )
+		{
+			offset = current.offset == nandLayout.envOffset ? redundOffset : nandLayout.envOffset;
+			env[4] = current.flags + 1;
+		}
+		else
+			env[4] = 1;
 	}
 
-	Crc crc;
+	encodeNandRs(image);
 
-	crc.i = crc32(0, env.data() + sizeof(uint32_t), env.length() - sizeof(uint32_t));
+	// the fresh ECC must check out without a single correction (ECC time)
+	vector<int> result(nandLayout.envBlocks());
 
-	if ( crc.b[0] != env[0]
-			|| crc.b[1] != env[1]
-			|| crc.b[2] != env[2]
-			|| crc.b[3] != env[3] )
+	if ( verifyPages(image.bytes(), pages, result.data()) != 0
+			|| count(result.begin(), result.end(), 0) != (ptrdiff_t)result.size() )
 	{
-		cerr << "decodeEnv: environment checksum mismatch." << endl;
+		cerr << "encodeEnv->encodeNandRs->decodeNandRs fails" << endl;
 		exit(1);
 	}
 
-	u8string ret;
+	// whatever gets programmed, a cached decode of the old env is stale
+	if ( source == MtdSource )
+		unlink(cacheFile(mtdDev).c_str());
+
+	cout << "erasing " << mtdDev << " at 0x" << hex << offset << dec << endl;
 
-	for ( size_t i = 4; i < env.length() - 5; ++i )
 	{
-		if ( env[i] != '\0' )
-			ret += env[i];
-		else
-		{
-			ret += '\n';
+		PhaseTimer timer(ErasePhase);
+		mtd.eraseBlock(offset);
+	}
 
-			if ( env[i+1] == '\0' )
-				break;
-		}
+	cout << "writing " << pages << " pages with oob to " << mtdDev
+			<< " at 0x" << hex << offset << dec << endl;
+
+	{
+		PhaseTimer timer(ProgramPhase);
+		mtd.writePages(offset, pages, image.bytes());
 	}
 
-	return ret;
+	statsCount(BytesWritten, (uint64_t)pages * nandLayout.rawPageSize());
 }
 
-u8string encodeNandRs(u8string env)
+/*
+ * A plain env image (header, variables and padding, no ECC) mapped
+ * privately, it stays mapped for the rest of the run
+ */
+EnvCopy readEnvBin(const string &file)
 {
-	u8string nandRs;
+	const size_t envSize = nandLayout.envSize;
+	EnvCopy copy;
+	int fd = open(file.c_str(), O_RDONLY);
+	struct stat st;
 
-	for ( int i = 0; i < NAND_CHUNK_COUNT; ++i )
+	if ( fd < 0 || fstat(fd, &st) != 0 || st.st_size != (off_t)envSize )
 	{
-		u8string chunk = env.substr(i * NAND_CHUNK_SIZE, NAND_CHUNK_SIZE);
+		copy.error = "readEnvBin(): " + file + (fd < 0 ? string(": ") + strerror(errno)
+				: " is not a " + to_string(envSize) + " byte env");
 
-		Oob oob;
-		memset(oob.data.filler, -1, sizeof(oob.data.filler));
+		if ( fd >= 0 )
+			close(fd);
 
-		for ( size_t i = 0; i < 4; ++i )
-		{
-			calculate_ecc_rs(chunk.data() + (i * ECC_CHUNK_SIZE), oob.data.ecc_buffers[i]);
-		}
+		return copy;
+	}
+
+	void *map = mmap(0, envSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if ( map == MAP_FAILED )
+	{
+		copy.error = "readEnvBin(): unable to map " + file + ": " + strerror(errno);
+		return copy;
+	}
+
+	copy.env = ByteSpan((uint8_t *)map, envSize);
+	copy.crc = envCrc(copy.env);
+	copy.clean = true;
+	decodeEnv(copy);
+	return copy;
+}
 
-		chunk.append(&oob.b[0], sizeof(oob));
-		nandRs.append(chunk);
+// write the env to a plain env image with one write
+void commitEnvBin(const string &file, ByteSpan env, const EnvCopy &current)
+{
+	if ( current.valid && sameEnv(env, current.env) )
+	{
+		cout << file << ": unchanged" << endl;
+		return;
 	}
 
-	if ( nandRs.length() != ENV_SIZE + (sizeof(Oob) * NAND_CHUNK_COUNT) )
+	if ( redundOffset )
+		env[4] = current.valid ? current.flags + 1 : 1;
+
+	PhaseTimer timer(ProgramPhase);
+	int fd = open(file.c_str(), O_WRONLY | O_CREAT, 0644);
+
+	if ( fd < 0 || pwrite(fd, env.data, env.size, 0) != (ssize_t)env.size
+			|| ftruncate(fd, env.size) != 0 || close(fd) != 0 )
 	{
-		cerr << "encodeNandRs(): incorrect nandRs size, aborting!" << endl;
+		cerr << "commitEnvBin(): unable to write " << file << ": " << strerror(errno) << endl;
 		exit(1);
 	}
 
-	return nandRs;
+	statsCount(BytesWritten, env.size);
+	cout << "writing env to " << file << endl;
+}
+
+// the one image buffer of the process, made on first use for the final
+// layout
+NandImage &imageBuffer()
+{
+	static NandImage image;
+	return image;
 }
 
-u8string decodeNandRs(u8string nandRs)
+// the text may live in an image file mapped by 'mtd'
+TextSpan getEnvText(const string &mtdDev, unique_ptr<NandDevice> &mtd)
 {
-	if ( nandRs.length() != ENV_SIZE + (sizeof(Oob) * NAND_CHUNK_COUNT) )
+	// the device completes the layout the image buffer is made for
+	mtd = openDevice(mtdDev, false);
+
+	EnvCopy copy(readCurrent(mtd.get(), mtdDev, imageBuffer(), true));
+
+	if ( ! copy.valid )
 	{
-		cerr << "decodeNandRs(): incorrect nandRs size, aborting!" << endl;
+		cerr << copy.error << endl;
 		exit(1);
 	}
 
-	u8string env;
+	PhaseTimer timer(ParsePhase);
+	return decodeEnvText(copy.vars);
+}
 
-	for ( size_t chunkNum = 0; chunkNum < NAND_CHUNK_COUNT; ++chunkNum )
+/*
+ * The env to use, decoded into the image.  With a redundant env the
+ * newer copy (by its serial, read from the first page only) is read first
+ * and the other one only if that fails.
+ */
+EnvCopy readEnv(NandDevice &mtd, NandImage &image)
+{
+	if ( ! redundOffset )
 	{
-		size_t chunkStart = chunkNum * (NAND_CHUNK_SIZE + sizeof(Oob));
-		size_t oobStart = chunkStart + NAND_CHUNK_SIZE;
-		u8string chunk = nandRs.substr(chunkStart, NAND_CHUNK_SIZE);
-		u8string oobS = nandRs.substr(oobStart, sizeof(Oob));
-		Oob oob;
+		EnvCopy copy(nandLayout.envOffset);
+		readEnvCopy(mtd, image, copy);
+		return copy;
+	}
 
-		oobS.copy(&oob.b[0], oobS.length());
+	EnvCopy copies[2] = { EnvCopy(nandLayout.envOffset), EnvCopy(redundOffset) };
+	bool header[2];
 
-		for ( size_t blockNum = 0; blockNum < 4; ++blockNum )
-		{
-			uint8_t eccChunk[ECC_CHUNK_SIZE];
-			chunk.copy(eccChunk, ECC_CHUNK_SIZE, blockNum * ECC_CHUNK_SIZE);
-			uint8_t computedEcc[ECC_SIZE];
+	for ( int i = 0; i < 2; ++i )
+		header[i] = peekFlags(mtd, copies[i].offset, copies[i].flags);
 
-			calculate_ecc_rs(eccChunk, computedEcc);
+	int first = header[1] && ( ! header[0]
+			|| redundNewer(copies[0].flags, copies[1].flags) ) ? 1 : 0;
 
-			if ( correct_data_rs( eccChunk, oob.data.ecc_buffers[blockNum], computedEcc) < 0 )
-			{
-				cerr << "decodeNandRs(): too many errors in block #" << blockNum
-						<< " of chunk #" << chunkNum << endl;
-				exit(1);
-			}
+	for ( int i = 0; i < 2; ++i )
+	{
+		EnvCopy &copy(copies[first ^ i]);
+
+		if ( readEnvCopy(mtd, image, copy) )
+		{
+			if ( i && header[first] )
+				cerr << "warning: " << copies[first].error << ", using the env copy at 0x"
+						<< hex << copy.offset << dec << endl;
 
-			env.append(eccChunk, sizeof(eccChunk));
+			return copy;
 		}
 	}
 
-	if ( env.length() != ENV_SIZE )
+	EnvCopy none;
+	none.error = copies[0].error + "; " + copies[1].error;
+	return none;
+}
+
+/*
+ * readEnv() through the --cache: as long as the first page of every copy
+ * and the ECC counters are what they were when the cached env was decoded
+ * the nand holds the same env and the cached one is used
+ */
+EnvCopy readEnvCached(NandDevice &mtd, const string &mtdDev, NandImage &image)
+{
+	if ( cacheDir.empty() )
+		return readEnv(mtd, image);
+
+	// the key is taken first, a write racing with the read below can
+	// only make the stored key stale, never the cached env
+	const CacheKey key(cacheKey(mtd));
+	const string file(cacheFile(mtdDev));
+	EnvCopy copy;
+
+	if ( loadCache(file, key, image, copy) )
+		return copy;
+
+	copy = readEnv(mtd, image);
+
+	if ( copy.valid )
+		storeCache(file, key, copy);
+
+	return copy;
+}
+
+string cacheFile(const string &mtdDev)
+{
+	const string &dir(cacheDir.empty() ? string(defaultCacheDir) : cacheDir);
+
+	return dir + "/" + mtdDev.substr(mtdDev.rfind('/') + 1) + ".env";
+}
+
+CacheKey cacheKey(NandDevice &mtd)
+{
+	CacheKey key;
+	const uint32_t offsets[2] = { nandLayout.envOffset, redundOffset };
+	vector<uint8_t> page(nandLayout.rawPageSize());
+
+	memset(&key, 0, sizeof(key));
+	key.envOffset = nandLayout.envOffset;
+	key.redundOffset = redundOffset;
+
+	for ( int i = 0; i < (redundOffset ? 2 : 1); ++i )
 	{
-		cerr << "decodeNandRs(): incorrect env size, aborting!" << endl;
-		exit(1);
+		if ( mtd.isBad(offsets[i]) )
+			continue;
+
+		string error;
+
+		if ( ! readRaw(mtd, offsets[i], 1, page.data(), error) )
+		{
+			cerr << error << endl;
+			exit(1);
+		}
+
+		key.firstPage[i] = crc32(0, page.data(), page.size());
 	}
 
-	return env;
+	mtd.eccStats(key.stats);
+	return key;
 }
 
-/* ========================================================================
- * Table of CRC-32's of all single-byte values (made by make_crc_table)
+/*
+ * The cached env for 'key' into the image.  Only a regular file of our own
+ * that nobody else can write is trusted, and the variables must still
+ * match the env crc.
  */
-const uint32_t crc_table[256] = {
-  0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
-  0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
-  0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
-  0x90bf1d91L, 0x1db71064L, 0x6ab020f2L, 0xf3b97148L, 0x84be41deL,
-  0x1adad47dL, 0x6ddde4ebL, 0xf4d4b551L, 0x83d385c7L, 0x136c9856L,
-  0x646ba8c0L, 0xfd62f97aL, 0x8a65c9ecL, 0x14015c4fL, 0x63066cd9L,
-  0xfa0f3d63L, 0x8d080df5L, 0x3b6e20c8L, 0x4c69105eL, 0xd56041e4L,
-  0xa2677172L, 0x3c03e4d1L, 0x4b04d447L, 0xd20d85fdL, 0xa50ab56bL,
-  0x35b5a8faL, 0x42b2986cL, 0xdbbbc9d6L, 0xacbcf940L, 0x32d86ce3L,
-  0x45df5c75L, 0xdcd60dcfL, 0xabd13d59L, 0x26d930acL, 0x51de003aL,
-  0xc8d75180L, 0xbfd06116L, 0x21b4f4b5L, 0x56b3c423L, 0xcfba9599L,
-  0xb8bda50fL, 0x2802b89eL, 0x5f058808L, 0xc60cd9b2L, 0xb10be924L,
-  0x2f6f7c87L, 0x58684c11L, 0xc1611dabL, 0xb6662d3dL, 0x76dc4190L,
-  0x01db7106L, 0x98d220bcL, 0xefd5102aL, 0x71b18589L, 0x06b6b51fL,
-  0x9fbfe4a5L, 0xe8b8d433L, 0x7807c9a2L, 0x0f00f934L, 0x9609a88eL,
-  0xe10e9818L, 0x7f6a0dbbL, 0x086d3d2dL, 0x91646c97L, 0xe6635c01L,
-  0x6b6b51f4L, 0x1c6c6162L, 0x856530d8L, 0xf262004eL, 0x6c0695edL,
-  0x1b01a57bL, 0x8208f4c1L, 0xf50fc457L, 0x65b0d9c6L, 0x12b7e950L,
-  0x8bbeb8eaL, 0xfcb9887cL, 0x62dd1ddfL, 0x15da2d49L, 0x8cd37cf3L,
-  0xfbd44c65L, 0x4db26158L, 0x3ab551ceL, 0xa3bc0074L, 0xd4bb30e2L,
-  0x4adfa541L, 0x3dd895d7L, 0xa4d1c46dL, 0xd3d6f4fbL, 0x4369e96aL,
-  0x346ed9fcL, 0xad678846L, 0xda60b8d0L, 0x44042d73L, 0x33031de5L,
-  0xaa0a4c5fL, 0xdd0d7cc9L, 0x5005713cL, 0x270241aaL, 0xbe0b1010L,
-  0xc90c2086L, 0x5768b525L, 0x206f85b3L, 0xb966d409L, 0xce61e49fL,
-  0x5edef90eL, 0x29d9c998L, 0xb0d09822L, 0xc7d7a8b4L, 0x59b33d17L,
-  0x2eb40d81L, 0xb7bd5c3bL, 0xc0ba6cadL, 0xedb88320L, 0x9abfb3b6L,
-  0x03b6e20cL, 0x74b1d29aL, 0xead54739L, 0x9dd277afL, 0x04db2615L,
-  0x73dc1683L, 0xe3630b12L, 0x94643b84L, 0x0d6d6a3eL, 0x7a6a5aa8L,
-  0xe40ecf0bL, 0x9309ff9dL, 0x0a00ae27L, 0x7d079eb1L, 0xf00f9344L,
-  0x8708a3d2L, 0x1e01f268L, 0x6906c2feL, 0xf762575dL, 0x806567cbL,
-  0x196c3671L, 0x6e6b06e7L, 0xfed41b76L, 0x89d32be0L, 0x10da7a5aL,
-  0x67dd4accL, 0xf9b9df6fL, 0x8ebeeff9L, 0x17b7be43L, 0x60b08ed5L,
-  0xd6d6a3e8L, 0xa1d1937eL, 0x38d8c2c4L, 0x4fdff252L, 0xd1bb67f1L,
-  0xa6bc5767L, 0x3fb506ddL, 0x48b2364bL, 0xd80d2bdaL, 0xaf0a1b4cL,
-  0x36034af6L, 0x41047a60L, 0xdf60efc3L, 0xa867df55L, 0x316e8eefL,
-  0x4669be79L, 0xcb61b38cL, 0xbc66831aL, 0x256fd2a0L, 0x5268e236L,
-  0xcc0c7795L, 0xbb0b4703L, 0x220216b9L, 0x5505262fL, 0xc5ba3bbeL,
-  0xb2bd0b28L, 0x2bb45a92L, 0x5cb36a04L, 0xc2d7ffa7L, 0xb5d0cf31L,
-  0x2cd99e8bL, 0x5bdeae1dL, 0x9b64c2b0L, 0xec63f226L, 0x756aa39cL,
-  0x026d930aL, 0x9c0906a9L, 0xeb0e363fL, 0x72076785L, 0x05005713L,
-  0x95bf4a82L, 0xe2b87a14L, 0x7bb12baeL, 0x0cb61b38L, 0x92d28e9bL,
-  0xe5d5be0dL, 0x7cdcefb7L, 0x0bdbdf21L, 0x86d3d2d4L, 0xf1d4e242L,
-  0x68ddb3f8L, 0x1fda836eL, 0x81be16cdL, 0xf6b9265bL, 0x6fb077e1L,
-  0x18b74777L, 0x88085ae6L, 0xff0f6a70L, 0x66063bcaL, 0x11010b5cL,
-  0x8f659effL, 0xf862ae69L, 0x616bffd3L, 0x166ccf45L, 0xa00ae278L,
-  0xd70dd2eeL, 0x4e048354L, 0x3903b3c2L, 0xa7672661L, 0xd06016f7L,
-  0x4969474dL, 0x3e6e77dbL, 0xaed16a4aL, 0xd9d65adcL, 0x40df0b66L,
-  0x37d83bf0L, 0xa9bcae53L, 0xdebb9ec5L, 0x47b2cf7fL, 0x30b5ffe9L,
-  0xbdbdf21cL, 0xcabac28aL, 0x53b39330L, 0x24b4a3a6L, 0xbad03605L,
-  0xcdd70693L, 0x54de5729L, 0x23d967bfL, 0xb3667a2eL, 0xc4614ab8L,
-  0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
-  0x2d02ef8dL
-};
+bool loadCache(const string &file, const CacheKey &key, NandImage &image, EnvCopy &copy)
+{
+	int fd = open(file.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+	if ( fd < 0 )
+		return false;
+
+	struct stat st;
+	CacheHeader hdr;
+	ByteSpan env(image.bytes(), nandLayout.envSize);
+	const size_t header = envHeader();
+	bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_uid == geteuid()
+			&& ! (st.st_mode & (S_IWGRP | S_IWOTH))
+			&& read(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+			&& memcmp(hdr.magic, "plugenv1", sizeof(hdr.magic)) == 0
+			&& memcmp(&hdr.key, &key, sizeof(key)) == 0
+			&& hdr.size <= env.size - header
+			&& read(fd, env.data + header, hdr.size) == (ssize_t)hdr.size;
+
+	close(fd);
+
+	if ( ! ok )
+		return false;
+
+	Crc crc;
+
+	memcpy(crc.b, hdr.crc, sizeof(crc.b));
+
+	if ( crc32Zeros(crc32(0, env.data + header, hdr.size), env.size - header - hdr.size) != crc.i )
+		return false;
+
+	memcpy(env.data, hdr.crc, sizeof(hdr.crc));
+
+	if ( redundOffset )
+		env[4] = hdr.flags;
+
+	memset(env.data + header + hdr.size, 0, env.size - header - hdr.size);
 
-uint32_t crc32(const u8string &s)
+	copy = EnvCopy(hdr.offset);
+	copy.valid = true;
+	copy.clean = hdr.clean;
+	copy.flags = hdr.flags;
+	copy.env = env;
+	copy.vars = ByteSpan(env.data + header, hdr.size);
+	return true;
+}
+
+// best effort, a cache that can't be written is just not used
+void storeCache(const string &file, const CacheKey &key, const EnvCopy &copy)
+{
+	CacheHeader hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "plugenv1", sizeof(hdr.magic));
+	hdr.key = key;
+	hdr.offset = copy.offset;
+	memcpy(hdr.crc, copy.env.data, sizeof(hdr.crc));
+	hdr.flags = copy.flags;
+	hdr.clean = copy.clean;
+	hdr.size = copy.vars.size;
+
+	mkdir(file.substr(0, file.rfind('/')).c_str(), 0700);
+
+	string tmp(file + ".XXXXXX");
+	int fd = mkstemp(&tmp[0]);
+
+	if ( fd < 0 )
+		return;
+
+	bool ok = ::write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+			&& ::write(fd, copy.vars.data, copy.vars.size) == (ssize_t)copy.vars.size;
+
+	if ( close(fd) == 0 && ok && rename(tmp.c_str(), file.c_str()) == 0 )
+		return;
+
+	unlink(tmp.c_str());
+}
+
+bool readEnvCopy(NandDevice &mtd, NandImage &image, EnvCopy &copy)
 {
-	return crc32(0, s.data(), s.length());
+	if ( mtd.isBad(copy.offset) )
+	{
+		ostringstream err;
+		err << "readEnvCopy(): block at 0x" << hex << copy.offset << " is marked bad";
+		copy.error = err.str();
+		return false;
+	}
+
+	// the driver's ECC first, the RS ECC only if that fails
+	if ( hwEcc && readHwEcc(mtd, image, copy) )
+		return true;
+
+	// pages in memory (an image file) are corrected where they are
+	if ( uint8_t *raw = mtd.mapPages(copy.offset, nandLayout.envPages()) )
+		return decodeNandRs(raw, copy) && decodeEnv(copy);
+
+	// read on a thread of its own while the pages already in are corrected
+	const uint32_t pageOffset = copy.offset;
+	auto read = [&mtd, pageOffset](unsigned first, unsigned pages, uint8_t *raw, string &error)
+			{
+				return readRaw(mtd, pageOffset + first * nandLayout.pageSize, pages, raw, error);
+			};
+
+	return decodeNandRs(image.bytes(), copy, read) && decodeEnv(copy);
+}
+
+bool readRaw(NandDevice &mtd, uint32_t offset, unsigned pages, uint8_t *buf, string &error)
+{
+	PhaseTimer timer(ReadPhase);
+
+	if ( ! mtd.readPages(offset, pages, buf, error) )
+		return false;
+
+	statsCount(BytesRead, (uint64_t)pages * nandLayout.rawPageSize());
+	return true;
 }
 
-#define DO1(buf) crc = crc_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
-#define DO2(buf)  DO1(buf); DO1(buf);
-#define DO4(buf)  DO2(buf); DO2(buf);
-#define DO8(buf)  DO4(buf); DO4(buf);
-uint32_t crc32 (uint32_t crc, const uint8_t *buf, unsigned int len)
+/*
+ * Read a copy through the driver's ECC and check its env, ECCGETSTATS
+ * before and after the read tells what the driver corrected or failed on
+ * (another reader of the partition in between only costs the fast path).
+ * False if it failed, the device has no ECC or the env doesn't check out:
+ * an env with just the RS ECC reads as garbage this way.
+ */
+bool readHwEcc(NandDevice &mtd, NandImage &image, EnvCopy &copy)
 {
-	crc = crc ^ 0xffffffffL;
+	mtd_ecc_stats delta;
+	EnvCopy hw(copy.offset);
+
+	if ( ! readHw(mtd, copy.offset, nandLayout.envPages(), image.bytes(), delta) )
+		return false;
 
-	while ( len >= 8 )
+	if ( delta.failed )
 	{
-		DO8(buf);
-		len -= 8;
+		cerr << "warning: the nand driver's ECC failed " << delta.failed
+				<< " times on the env at 0x" << hex << copy.offset << dec
+				<< ", correcting it with the RS ECC" << endl;
+		return false;
 	}
 
-	if ( len )
+	hw.env = ByteSpan(image.bytes(), nandLayout.envSize);
+	hw.crc = envCrc(hw.env);
+	hw.corrected = delta.corrected;
+	hw.clean = delta.corrected == 0;
+
+	if ( ! decodeEnv(hw) )
+		return false;
+
+	copy = hw;
+	return true;
+}
+
+// the change of the driver's ECC counters over a readData(), false if
+// there are no counters or no driver ECC
+bool readHw(NandDevice &mtd, uint32_t offset, unsigned pages, uint8_t *buf, mtd_ecc_stats &delta)
+{
+	PhaseTimer timer(ReadPhase);
+	mtd_ecc_stats before, after;
+
+	if ( ! mtd.eccStats(before) || ! mtd.readData(offset, pages, buf) )
+		return false;
+
+	mtd.eccStats(after);
+	delta.corrected = after.corrected - before.corrected;
+	delta.failed = after.failed - before.failed;
+	delta.badblocks = after.badblocks - before.badblocks;
+	delta.bbtblocks = after.bbtblocks - before.bbtblocks;
+
+	statsCount(BytesRead, (uint64_t)pages * nandLayout.pageSize);
+	statsCount(DriverCorrected, delta.corrected);
+	statsCount(DriverFailed, delta.failed);
+	return true;
+}
+
+// serial of the redundant env copy at 'offset' if its first page decodes
+// and isn't erased
+bool peekFlags(NandDevice &mtd, uint32_t offset, uint8_t &flags)
+{
+	vector<uint8_t> page(nandLayout.rawPageSize());
+	vector<int> result(nandLayout.steps());
+	mtd_ecc_stats delta;
+
+	if ( mtd.isBad(offset) )
+		return false;
+
+	// the data is at the start of the page either way
+	if ( ! hwEcc || ! readHw(mtd, offset, 1, page.data(), delta) || delta.failed )
 	{
-		do
-		{
-			DO1(buf);
-		} while ( --len );
+		string error;
+
+		if ( ! readRaw(mtd, offset, 1, page.data(), error)
+				|| verifyPages(page.data(), 1, result.data()) )
+			return false;
 	}
 
-	return crc ^ 0xffffffffL;
+	if ( count(page.begin(), page.begin() + nandLayout.pageSize, 0xff) == nandLayout.pageSize )
+		return false;
+
+	flags = page[4];
+	return true;
 }
 
-}; // anonymous namespace
+/*
+ * u-boot's choice between two valid copies (env_import_redund): the
+ * higher serial wins, 255 -> 0 counts as a step forward and equal serials
+ * select the first copy
+ */
+bool redundNewer(uint8_t flags, uint8_t redundFlags)
+{
+	if ( flags == 255 && redundFlags == 0 )
+		return true;
+
+	if ( redundFlags == 255 && flags == 0 )
+		return false;
 
+	return redundFlags > flags;
+}
+
+}; // anonymous namespace
@@ -0,0 +1,744 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "crc32.h"
+#include "ecc_rs.h"
+#include "nandenv.h"
+
+using namespace std;
+
+/*
+ * Benchmarks of the ECC, crc and env hot paths on synthetic data, no nand
+ * needed.  Every result is one JSON object per line:
+ *
+ *	{"bench":"verify_blocks_rs","kernel":"avx2","errors":1,"ns_per_block":512.3}
+ *
+ * Usage: plugenvbench [seconds per measurement]
+ *
+ * With -x it injects errors into the blocks of an encoded env image
+ * instead and profiles the decoder on them, see usage().
+ */
+
+namespace {
+
+typedef chrono::steady_clock Clock;
+
+double seconds = 0.2;
+
+// fills the benchmark data, the same every run
+struct Random
+{
+	uint32_t x;
+
+	Random() : x(2463534242u) {}
+
+	uint32_t operator()()
+	{
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return x;
+	}
+};
+
+// time per call of fn(), which does 'batch' calls per invocation
+template <class F>
+double measure(F fn, size_t batch = 1)
+{
+	Clock::time_point start = Clock::now();
+	double elapsed;
+	size_t calls = 0;
+
+	do
+	{
+		fn();
+		calls += batch;
+		elapsed = chrono::duration<double>(Clock::now() - start).count();
+	} while ( elapsed < seconds );
+
+	return elapsed / calls;
+}
+
+// measure() for work that changes its input: prepare() restores it before
+// every fn() and isn't timed
+template <class P, class F>
+double measure(P prepare, F fn, size_t batch)
+{
+	Clock::time_point start = Clock::now();
+	double elapsed = 0;
+	size_t calls = 0;
+
+	do
+	{
+		prepare();
+
+		Clock::time_point t = Clock::now();
+
+		fn();
+		elapsed += chrono::duration<double>(Clock::now() - t).count();
+		calls += batch;
+	} while ( chrono::duration<double>(Clock::now() - start).count() < seconds );
+
+	return elapsed / calls;
+}
+
+// the JSON object of one result, fields are added in order
+class Result
+{
+public:
+	explicit Result(const char *bench) { out_ << "{\"bench\":\"" << bench << "\""; }
+
+	Result &operator()(const char *key, const string &value)
+	{
+		out_ << ",\"" << key << "\":\"" << value << "\"";
+		return *this;
+	}
+
+	Result &operator()(const char *key, double value) { return field(key, value); }
+	Result &operator()(const char *key, int value) { return field(key, value); }
+	Result &operator()(const char *key, unsigned value) { return field(key, value); }
+	Result &operator()(const char *key, size_t value) { return field(key, value); }
+
+	~Result() { cout << out_.str() << "}" << endl; }
+
+private:
+	template <class T>
+	Result &field(const char *key, T value)
+	{
+		out_ << ",\"" << key << "\":" << value;
+		return *this;
+	}
+
+	ostringstream out_;
+};
+
+// 'fill' share of the env size worth of variables, one per line
+string envText(double fill)
+{
+	string text;
+	Random rnd;
+
+	while ( text.size() < nandLayout.envSize * fill )
+		text += "var" + to_string(text.size()) + "=" + string(8 + rnd() % 64, 'a' + rnd() % 26) + "\n";
+
+	return text;
+}
+
+const char *const rsKernels[] = { "scalar", "sse2", "avx2", "neon" };
+const char *const crcEngines[] = { "slice8", "pclmul", "armv8" };
+const int blockCount = 256;	// the blocks of one env
+
+// 'blockCount' encoded blocks with 'errors' distinct symbol errors each
+void makeBlocks(int errors, vector<uint8_t> &data, vector<uint8_t> &ecc)
+{
+	Random rnd;
+
+	data.resize(blockCount * 512);
+	ecc.resize(blockCount * ECC_SIZE);
+
+	for ( size_t i = 0; i < data.size(); ++i )
+		data[i] = rnd();
+
+	for ( int b = 0; b < blockCount; ++b )
+	{
+		uint8_t *block = &data[b * 512];
+
+		calculate_ecc_rs(block, &ecc[b * ECC_SIZE]);
+
+		// one byte is one symbol, every error in a new one
+		size_t pos[4];
+
+		for ( int e = 0; e < errors; ++e )
+		{
+			do
+				pos[e] = rnd() % 512;
+			while ( find(pos, pos + e, pos[e]) != pos + e );
+
+			block[pos[e]] ^= 1 + rnd() % 255;
+		}
+	}
+}
+
+void benchEncode()
+{
+	vector<uint8_t> data, ecc;
+
+	makeBlocks(0, data, ecc);
+
+	int b = 0;
+	double t = measure([&]
+			{
+				calculate_ecc_rs(&data[b * 512], &ecc[b * ECC_SIZE]);
+				b = (b + 1) % blockCount;
+			});
+
+	Result("calculate_ecc_rs")("ns_per_block", t * 1e9);
+}
+
+/*
+ * The correction works in place: prepare() restores the corrupted blocks
+ * and their ECC outside the timed region, ns_per_block is the decoder alone
+ */
+void benchCorrect()
+{
+	for ( int errors = 0; errors <= 4; ++errors )
+	{
+		vector<uint8_t> data, ecc, calc(blockCount * ECC_SIZE);
+
+		makeBlocks(errors, data, ecc);
+
+		for ( int b = 0; b < blockCount; ++b )
+			calculate_ecc_rs(&data[b * 512], &calc[b * ECC_SIZE]);
+
+		// just the correction: the blocks and their ECC are restored untimed
+		vector<uint8_t> work, storeWork, calcWork;
+		double t = measure([&]
+				{
+					work = data;
+					storeWork = ecc;
+					calcWork = calc;
+				},
+				[&]
+				{
+					for ( int b = 0; b < blockCount; ++b )
+						correct_data_rs(&work[b * 512], &storeWork[b * ECC_SIZE],
+								&calcWork[b * ECC_SIZE]);
+				}, blockCount);
+
+		Result("correct_data_rs")("errors", errors)("ns_per_block", t * 1e9);
+
+		for ( const char *kernel : rsKernels )
+		{
+			const rs_codec *codec = rs_codec_get(kernel);
+
+			if ( ! codec )
+				continue;
+
+			vector<uint8_t> blocks(data.size());
+			uint8_t *dp[blockCount];
+			const uint8_t *ep[blockCount];
+
+			for ( int i = 0; i < blockCount; ++i )
+			{
+				dp[i] = &blocks[i * 512];
+				ep[i] = &ecc[i * ECC_SIZE];
+			}
+
+			t = measure([&] { memcpy(blocks.data(), data.data(), data.size()); },
+					[&] { rs_verify_blocks(codec, dp, ep, blockCount, 0); }, blockCount);
+
+			Result("verify_blocks_rs")("kernel", kernel)("errors", errors)
+					("ns_per_block", t * 1e9);
+		}
+	}
+}
+
+void benchCrc()
+{
+	const size_t sizes[] = { 64, 2048, 128 * 1024, 4 * 1024 * 1024 };
+	vector<uint8_t> buf(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	Random rnd;
+
+	for ( size_t i = 0; i < buf.size(); ++i )
+		buf[i] = rnd();
+
+	string best(crc32Engine());
+
+	for ( const char *engine : crcEngines )
+	{
+		if ( ! setCrc32Engine(engine) )
+			continue;
+
+		for ( size_t size : sizes )
+		{
+			uint32_t crc = 0;
+			double t = measure([&] { crc = crc32(crc, buf.data(), size); });
+
+			Result("crc32")("engine", engine)("bytes", size)
+					("mb_per_s", size / t / 1e6);
+		}
+
+		const size_t bytes = nandLayout.envSize - 1000;
+		double t = measure([&] { crc32Zeros(0x12345678, bytes); });
+
+		Result("crc32Zeros")("engine", engine)("bytes", bytes)
+				("ns", t * 1e9);
+	}
+
+	setCrc32Engine(best.c_str());
+}
+
+/*
+ * The whole env path on a 'fill' share of the env size worth of
+ * variables: text -> env -> nand image -> corrected env -> checked env
+ */
+void benchEnv(double fill)
+{
+	const string text(envText(fill));
+
+	unique_ptr<NandImage> image(new NandImage);
+	double stage[4] = {};
+	size_t runs = 0;
+	Clock::time_point start = Clock::now();
+
+	do
+	{
+		Clock::time_point t[5];
+		EnvCopy copy;
+		istringstream in(text);
+
+		t[0] = Clock::now();
+		encodeEnv(in, *image);
+		t[1] = Clock::now();
+		encodeNandRs(*image);
+		t[2] = Clock::now();
+
+		bool ok = decodeNandRs(image->bytes(), copy);
+
+		t[3] = Clock::now();
+		ok = ok && decodeEnv(copy);
+		t[4] = Clock::now();
+
+		if ( ! ok )
+		{
+			cerr << "benchEnv(): " << copy.error << endl;
+			exit(1);
+		}
+
+		for ( int i = 0; i < 4; ++i )
+			stage[i] += chrono::duration<double>(t[i + 1] - t[i]).count();
+
+		++runs;
+	} while ( chrono::duration<double>(Clock::now() - start).count() < seconds );
+
+	const char *names[] = { "encodeEnv", "encodeNandRs", "decodeNandRs", "decodeEnv" };
+	double total = 0;
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		Result("env")("stage", names[i])("fill", fill)("jobs", jobCount)
+				("page", nandLayout.pageSize)("oob", nandLayout.oobSize)
+				("us", stage[i] / runs * 1e6);
+		total += stage[i];
+	}
+
+	Result("env")("stage", "total")("fill", fill)("jobs", jobCount)
+			("page", nandLayout.pageSize)("oob", nandLayout.oobSize)
+			("us", total / runs * 1e6);
+}
+
+
+/*
+ * Error injection (-x).  Every case corrupts one block of the image with
+ * 'errors' errors and runs verify_data_rs() on it; a case is corrected
+ * when the original data comes back, failed when the decoder gives up and
+ * miscorrected when it returns wrong data as good.
+ *
+ * A block is a codeword of 520 symbols: the 512 data bytes, then the 8
+ * parity symbols of 10 bits packed into the 10 ECC bytes.
+ */
+enum Mode { Symbol, Bit, Burst, ModeCount };
+enum Outcome { Corrected, Failed, Miscorrected };
+
+const char *const modeNames[ModeCount] = { "symbol", "bit", "burst" };
+const int maxErrors = 5;	// one more than the 4 symbols the code corrects
+const int codeSymbols = 512 + 8;
+const int codeBits = 512 * 8 + ECC_SIZE * 8;
+
+// one injected block as stored in a corpus file
+struct Case
+{
+	uint8_t mode;
+	uint8_t errors;
+	uint8_t outcome;
+	uint8_t pad;
+	int32_t result;		// of verify_data_rs()
+	uint32_t crc;		// of the data verify_data_rs() left
+	uint8_t data[512];	// corrupted
+	uint8_t ecc[ECC_SIZE];
+	uint8_t pad2[2];
+};
+
+static_assert(sizeof(Case) == 536, "corpus records are 536 bytes");
+
+const char corpusMagic[8] = { 'e', 'c', 'c', 'c', 'o', 'r', 'p', '1' };
+
+void flipBit(Case &c, int bit)
+{
+	if ( bit < 512 * 8 )
+		c.data[bit / 8] ^= 1 << (bit % 8);
+	else
+		c.ecc[(bit - 512 * 8) / 8] ^= 1 << (bit % 8);
+}
+
+// xor a non-zero error into symbol i
+void flipSymbol(Case &c, int i, Random &rnd)
+{
+	if ( i < 512 )
+	{
+		c.data[i] ^= 1 + rnd() % 255;
+		return;
+	}
+
+	unsigned e = 1 + rnd() % 1023;
+
+	for ( int b = 0; b < 10; ++b )
+		if ( e & (1 << b) )
+			flipBit(c, 512 * 8 + (i - 512) * 10 + b);
+}
+
+void inject(Case &c, Random &rnd)
+{
+	int pos[maxErrors];
+
+	if ( c.mode == Burst )
+	{
+		int start = rnd() % (codeSymbols - c.errors + 1);
+
+		for ( int e = 0; e < c.errors; ++e )
+			flipSymbol(c, start + e, rnd);
+
+		return;
+	}
+
+	const int range = c.mode == Bit ? codeBits : codeSymbols;
+
+	for ( int e = 0; e < c.errors; ++e )
+	{
+		do
+			pos[e] = rnd() % range;
+		while ( find(pos, pos + e, pos[e]) != pos + e );
+
+		if ( c.mode == Bit )
+			flipBit(c, pos[e]);
+		else
+			flipSymbol(c, pos[e], rnd);
+	}
+}
+
+// latency and outcomes of the cases of one mode and error count
+struct Profile
+{
+	vector<double> ns;
+	size_t outcomes[3];
+
+	Profile() : outcomes() {}
+
+	void report(int mode, int errors)
+	{
+		if ( ns.empty() )
+			return;
+
+		sort(ns.begin(), ns.end());
+
+		const size_t n = ns.size();
+
+		Result("inject")("mode", modeNames[mode])("errors", errors)("cases", n)
+				("corrected", outcomes[Corrected])("failed", outcomes[Failed])
+				("miscorrected", outcomes[Miscorrected])
+				("success_rate", (double)outcomes[Corrected] / n)
+				("miscorrection_rate", (double)outcomes[Miscorrected] / n)
+				("p50_ns", ns[n / 2])("p99_ns", ns[min(n - 1, n * 99 / 100)])
+				("max_ns", ns[n - 1]);
+	}
+};
+
+// decode a copy of the case, returns the time taken
+double decode(const Case &c, int &result, uint32_t &crc)
+{
+	uint8_t data[512];
+
+	memcpy(data, c.data, sizeof(data));
+
+	Clock::time_point start = Clock::now();
+
+	result = verify_data_rs(data, c.ecc);
+
+	double t = chrono::duration<double>(Clock::now() - start).count();
+
+	crc = crc32(0, data, sizeof(data));
+	return t;
+}
+
+void readImage(const string &file, NandImage &image)
+{
+	ifstream in(file.c_str(), ios::binary);
+
+	if ( ! in.read((char *)image.bytes(), image.size()) )
+	{
+		cerr << "plugenvbench: " << file << " is not a " << image.size()
+				<< " byte nand image" << endl;
+		exit(1);
+	}
+}
+
+/*
+ * Inject 'trials' cases per mode and error count into random blocks of the
+ * image, which must decode without a single correction
+ */
+void injectErrors(NandImage &image, int modes, size_t trials, uint32_t seed, const string &corpus)
+{
+	const NandLayout &l(nandLayout);
+	vector<int> result(l.envBlocks());
+
+	{
+		NandImage check(image);
+
+		if ( verifyPages(check.bytes(), l.envPages(), result.data()) != 0
+				|| count(result.begin(), result.end(), 0) != (ptrdiff_t)result.size() )
+		{
+			cerr << "plugenvbench: the image needs ECC correction, it must be clean" << endl;
+			exit(1);
+		}
+	}
+
+	ofstream out;
+
+	if ( ! corpus.empty() )
+	{
+		out.open(corpus.c_str(), ios::binary);
+		out.write(corpusMagic, sizeof(corpusMagic));
+
+		if ( ! out )
+		{
+			cerr << "plugenvbench: unable to write " << corpus << endl;
+			exit(1);
+		}
+	}
+
+	Random rnd;
+
+	rnd.x ^= seed;
+
+	for ( int mode = 0; mode < ModeCount; ++mode )
+	{
+		if ( ! (modes & (1 << mode)) )
+			continue;
+
+		for ( int errors = 1; errors <= maxErrors; ++errors )
+		{
+			Profile profile;
+
+			for ( size_t i = 0; i < trials; ++i )
+			{
+				const unsigned block = rnd() % l.envBlocks();
+				Case c;
+
+				memset(&c, 0, sizeof(c));
+				c.mode = mode;
+				c.errors = errors;
+				memcpy(c.data, image.bytes() + l.blockData(block), sizeof(c.data));
+				memcpy(c.ecc, image.bytes() + l.blockEcc(block), sizeof(c.ecc));
+
+				const uint32_t good = crc32(0, c.data, sizeof(c.data));
+
+				inject(c, rnd);
+				profile.ns.push_back(decode(c, c.result, c.crc) * 1e9);
+				c.outcome = c.result < 0 ? Failed : c.crc == good ? Corrected : Miscorrected;
+				++profile.outcomes[c.outcome];
+
+				if ( out.is_open() )
+					out.write((const char *)&c, sizeof(c));
+			}
+
+			profile.report(mode, errors);
+		}
+	}
+
+	if ( out.is_open() && ! out.flush() )
+	{
+		cerr << "plugenvbench: unable to write " << corpus << endl;
+		exit(1);
+	}
+}
+
+/*
+ * Decode the cases of a corpus again: the profile of the current decoder
+ * plus the cases where it no longer gives the recorded result
+ */
+int replayCorpus(const string &corpus)
+{
+	ifstream in(corpus.c_str(), ios::binary);
+	char magic[sizeof(corpusMagic)];
+
+	if ( ! in.read(magic, sizeof(magic)) || memcmp(magic, corpusMagic, sizeof(magic)) != 0 )
+	{
+		cerr << "plugenvbench: " << corpus << " is not an error corpus" << endl;
+		exit(1);
+	}
+
+	Profile profile[ModeCount][maxErrors + 1];
+	size_t cases = 0, changed = 0;
+	Case c;
+
+	while ( in.read((char *)&c, sizeof(c)) )
+	{
+		if ( c.mode >= ModeCount || c.errors < 1 || c.errors > maxErrors || c.outcome > Miscorrected )
+		{
+			cerr << "plugenvbench: bad record #" << cases << " in " << corpus << endl;
+			exit(1);
+		}
+
+		int result;
+		uint32_t crc;
+		Profile &p(profile[c.mode][c.errors]);
+
+		p.ns.push_back(decode(c, result, crc) * 1e9);
+		++p.outcomes[c.outcome];
+		++cases;
+
+		if ( result != c.result || crc != c.crc )
+		{
+			Result("replay_mismatch")("case", cases - 1)("mode", modeNames[c.mode])
+					("errors", (int)c.errors)("result", result)("expected", c.result);
+			++changed;
+		}
+	}
+
+	for ( int mode = 0; mode < ModeCount; ++mode )
+		for ( int errors = 1; errors <= maxErrors; ++errors )
+			profile[mode][errors].report(mode, errors);
+
+	Result("replay")("cases", cases)("mismatches", changed);
+	return changed ? 1 : 0;
+}
+
+void usage()
+{
+	cout << "Usage: plugenvbench [seconds]" << endl;
+	cout << "       plugenvbench -x [-i image] [-m mode] [-n cases] [-s seed] [-o corpus]" << endl;
+	cout << "       plugenvbench -r corpus" << endl;
+	cout << " -x: inject 1 to " << maxErrors << " errors per block and profile the decoder" << endl;
+	cout << " -i: raw env image (" << nandLayout.rawEnvSize() << " bytes, pages with oob) to corrupt," << endl;
+	cout << "     default: a synthetic env" << endl;
+	cout << " -m: symbol, bit or burst errors (default: all)" << endl;
+	cout << " -n: cases per mode and error count (default 10000)" << endl;
+	cout << " -s: random seed" << endl;
+	cout << " -o: save the cases as a corpus" << endl;
+	cout << " -r: decode a saved corpus again, exit 1 if any result differs" << endl;
+	exit(0);
+}
+
+}; // anonymous namespace
+
+int main(int argc, char *argv[])
+{
+	bool injecting(false);
+	string imageFile, corpus, replay;
+	int modes = (1 << ModeCount) - 1;
+	size_t trials = 10000;
+	uint32_t seed = 0;
+	int c;
+
+	while ( (c = getopt(argc, argv, "hi:m:n:o:r:s:x")) != -1 )
+	{
+		switch ( c )
+		{
+			case 'i':
+				imageFile = optarg;
+				break;
+			case 'm':
+			{
+				const char *const *m = find_if(modeNames, modeNames + ModeCount,
+						[](const char *name) { return strcmp(name, optarg) == 0; });
+
+				if ( m == modeNames + ModeCount )
+					usage();
+
+				modes = 1 << (m - modeNames);
+				break;
+			}
+			case 'n':
+				trials = strtoul(optarg, 0, 0);
+				break;
+			case 'o':
+				corpus = optarg;
+				break;
+			case 'r':
+				replay = optarg;
+				break;
+			case 's':
+				seed = strtoul(optarg, 0, 0);
+				break;
+			case 'x':
+				injecting = true;
+				break;
+			default:
+				usage();
+				break;
+		}
+	}
+
+	if ( ! replay.empty() )
+		return replayCorpus(replay);
+
+	if ( injecting )
+	{
+		unique_ptr<NandImage> image(new NandImage);
+
+		if ( imageFile.empty() )
+		{
+			istringstream in(envText(0.5));
+
+			encodeEnv(in, *image);
+			encodeNandRs(*image);
+		}
+		else
+			readImage(imageFile, *image);
+
+		injectErrors(*image, modes, trials, seed, corpus);
+		return 0;
+	}
+
+	if ( optind < argc )
+		seconds = atof(argv[optind]);
+
+	Result("config")("crc32_engine", crc32Engine())("rs_kernel", rs_syndrome_kernel())
+			("seconds", seconds);
+
+	benchEncode();
+	benchCorrect();
+	benchCrc();
+
+	for ( unsigned jobs : { 1u, 0u } )
+	{
+		jobCount = jobs;
+		benchEnv(0.05);
+		benchEnv(0.75);
+	}
+
+	// the other page layouts: 4K pages have their own code, 2K pages with
+	// a 128 byte oob take the generic one
+	const NandLayout sheeva(nandLayout);
+	const uint32_t layouts[][3] = { { 4096, 128, 0x40000 }, { 2048, 128, 0x20000 } };
+
+	jobCount = 1;
+
+	for ( const uint32_t *l : layouts )
+	{
+		nandLayout.pageSize = l[0];
+		nandLayout.oobSize = l[1];
+		nandLayout.blockSize = l[2];
+		nandLayout.eccOffset = nandLayout.eccAtEnd();
+		benchEnv(0.75);
+	}
+
+	nandLayout = sheeva;
+
+	return 0;
+}
@@ -0,0 +1,377 @@
+/*
+ * Shortened Reed-Solomon codec over GF(2**M) with compile time tables.
+ *
+ * Derived from the encoder/decoder of Simon Rockliff, University of
+ * Adelaide (21/9/89, 26/6/91):
+ *
+ *   This program may be freely modified and/or given to whoever wants it.
+ *   A condition of such distribution is that the author's contribution be
+ *   acknowledged by his name being left in the comments heading the program,
+ *   however no responsibility is accepted for any financial or other loss which
+ *   may result from some unforseen errors or malfunctioning of the program
+ *   during use.
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef REED_SOLOMON_H
+#define REED_SOLOMON_H
+
+#include <stdint.h>
+#include "galois.h"
+
+/*
+ * The full code has length N = 2**M - 1 with 2*T parity symbols and
+ * FullK = N - 2*T information symbols, of which only the first K bytes are
+ * ever non-zero: the codeword stored on the chip is data[0..K-1] at
+ * positions 0..K-1 followed by the parity at positions FullK..N-1.
+ *
+ * Several tables pack one GF element per 16 bit lane of 64 bit words,
+ * lane j in word j/4.
+ */
+template <class GF, unsigned T, unsigned K>
+struct RsTables
+{
+	typedef typename GF::Elem Elem;
+
+	static constexpr unsigned NK = 2 * T;
+	static constexpr unsigned Words = (NK + 3) / 4;
+
+	// generator polynomial, roots alpha**1 .. alpha**NK, polynomial form
+	Elem gen[NK + 1];
+
+	// enc[f]: lanes f * gen[0..NK-1]
+	uint64_t enc[GF::Size][Words];
+
+	// syn[r][d]: lanes d * alpha**((1+i)*r), i = 0..NK-1
+	uint64_t syn[8][256][Words];
+
+	// mul8[i][x] = x * alpha**(8*(1+i))
+	Elem mul8[NK][GF::Size];
+
+	constexpr RsTables()
+		: gen()
+		, enc()
+		, syn()
+		, mul8()
+	{
+		gen[0] = GF::exp(1);
+		gen[1] = 1;
+
+		for ( unsigned i = 2; i <= NK; ++i )
+		{
+			gen[i] = 1;
+
+			for ( unsigned j = i - 1; j > 0; --j )
+				gen[j] = gen[j - 1] ^ GF::mulExp(gen[j], i);
+
+			gen[0] = GF::mulExp(gen[0], i);
+		}
+
+		for ( unsigned f = 0; f < GF::Size; ++f )
+			for ( unsigned j = 0; j < NK; ++j )
+				enc[f][j / 4] |= (uint64_t)GF::mul(f, gen[j]) << (16 * (j % 4));
+
+		for ( unsigned r = 0; r < 8; ++r )
+			for ( unsigned d = 0; d < 256; ++d )
+				for ( unsigned i = 0; i < NK; ++i )
+					syn[r][d][i / 4] |= (uint64_t)GF::mul(d, GF::pow((1 + i) * r))
+						<< (16 * (i % 4));
+
+		for ( unsigned i = 0; i < NK; ++i )
+			for ( unsigned x = 0; x < GF::Size; ++x )
+				mul8[i][x] = GF::mul(x, GF::pow(8 * (1 + i)));
+	}
+};
+
+template <class GF, unsigned T, unsigned K>
+class ReedSolomon
+{
+public:
+	typedef typename GF::Elem Elem;
+
+	static constexpr unsigned N = GF::N;		// full code length
+	static constexpr unsigned NK = 2 * T;		// parity symbols
+	static constexpr unsigned FullK = N - NK;	// full code information symbols
+	static constexpr unsigned DataBytes = K;	// stored information symbols
+
+	static_assert(GF::Bits >= 8, "data bytes must fit in a symbol");
+	static_assert(K % 8 == 0 && K <= FullK, "unsupported shortened length");
+
+	/*
+	 * Systematic encode of K data bytes into NK parity symbols par[]:
+	 * the feedback shift register of the full code, skipping the clocks
+	 * for the FullK-K leading zero symbols (they leave the register zero),
+	 * every clock is a 16 bit shift, one lookup and Words XORs.
+	 * Codeword is c(X) = data(X)*X**NK + par(X)
+	 */
+	static void encode(const uint8_t *data, Elem par[NK])
+	{
+		uint64_t reg[Words] = {};
+
+		for ( int i = K - 1; i >= 0; --i )
+		{
+			const uint64_t *tab = tables_.enc[data[i] ^ (reg[TopWord] >> TopShift)];
+
+			for ( unsigned w = Words - 1; w > 0; --w )
+				reg[w] = ((reg[w] << 16) | (reg[w - 1] >> 48)) ^ tab[w];
+
+			reg[0] = (reg[0] << 16) ^ tab[0];
+
+			if ( NK % 4 )
+				reg[TopWord] &= (uint64_t(1) << (TopShift + 16)) - 1;
+		}
+
+		for ( unsigned j = 0; j < NK; ++j )
+			par[j] = Elem(reg[j / 4] >> (16 * (j % 4)));
+	}
+
+	/*
+	 * Syndromes of the stored codeword, i.e. the received polynomial
+	 * evaluated at alpha**(1+i), i = 0..NK-1, in polynomial form.
+	 * Horner's rule runs from the highest position (the parity) down:
+	 * syndromesParity() starts acc[] from the parity and folds in the
+	 * FullK-K zero symbols as one multiplication, syndromesData() continues
+	 * over the data 8 bytes per step.
+	 */
+	static void syndromesParity(const Elem par[NK], Elem acc[NK])
+	{
+		for ( unsigned i = 0; i < NK; ++i )
+		{
+			Elem a = 0;
+
+			for ( int j = NK - 1; j >= 0; --j )
+				a = GF::mulExp(a, 1 + i) ^ par[j];
+
+			acc[i] = GF::mul(a, GF::pow((unsigned long)(1 + i) * (FullK - K)));
+		}
+	}
+
+	static void syndromesData(const uint8_t *data, Elem acc[NK])
+	{
+		for ( int j = K - 8; j >= 0; j -= 8 )
+		{
+			uint64_t x[Words];
+
+			for ( unsigned w = 0; w < Words; ++w )
+				x[w] = tables_.syn[0][data[j]][w] ^ tables_.syn[1][data[j + 1]][w]
+					^ tables_.syn[2][data[j + 2]][w] ^ tables_.syn[3][data[j + 3]][w]
+					^ tables_.syn[4][data[j + 4]][w] ^ tables_.syn[5][data[j + 5]][w]
+					^ tables_.syn[6][data[j + 6]][w] ^ tables_.syn[7][data[j + 7]][w];
+
+			for ( unsigned i = 0; i < NK; ++i )
+				acc[i] = tables_.mul8[i][acc[i]] ^ Elem(x[i / 4] >> (16 * (i % 4)));
+		}
+	}
+
+	// returns true if any syndrome is non-zero
+	static bool syndromes(const uint8_t *data, const Elem par[NK], Elem syn[NK])
+	{
+		syndromesParity(par, syn);
+		syndromesData(data, syn);
+		return nonZero(syn);
+	}
+
+	static bool nonZero(const Elem syn[NK])
+	{
+		Elem e = 0;
+
+		for ( unsigned i = 0; i < NK; ++i )
+			e |= syn[i];
+
+		return e != 0;
+	}
+
+	/*
+	 * Error path, the syndromes syn[] (polynomial form) are not all zero.
+	 *
+	 * The error locator lambda(x) comes from the inversion-less
+	 * Berlekamp-Massey iteration (Sarwate and Shanbhag), lambda(x) and
+	 * omega(x) = s(x)*lambda(x) mod x**NK are only known up to a common
+	 * factor, which cancels in Forney's formula.  If deg(lambda) > T we
+	 * cannot correct all the errors.
+	 *
+	 * The Chien search only visits the K+NK positions that exist on the
+	 * chip, stepping every term lambda[j]*X**-j incrementally (an index add
+	 * of N-j per position) and jumping once over the FullK-K zero symbols.
+	 * The odd terms of that sum are X**-1 * lambda'(X**-1), and
+	 * omega(X**-1) is stepped the same way, so Forney's formula needs no
+	 * extra polynomial evaluation: the error value is one log domain
+	 * subtraction.  A root at a position that isn't stored, or fewer roots
+	 * than deg(lambda), means more than T errors.  Errors in the parity are
+	 * counted but need no correction.  data[] is only modified once all
+	 * errors are located.  Returns the number of errors or -1.
+	 */
+	static int decode(uint8_t *data, const Elem syn[NK])
+	{
+		Elem lambda[NK + 1] = { 1 };
+		Elem b[NK + 1] = { 1 };
+		Elem t[NK + 1];
+		Elem gamma = 1;
+		int k = 0;
+
+		for ( unsigned r = 0; r < NK; ++r )
+		{
+			// discrepancy
+			Elem delta = 0;
+
+			for ( unsigned i = 0; i <= r; ++i )
+				delta ^= GF::mul(lambda[i], syn[r - i]);
+
+			// lambda(x) <-- gamma*lambda(x) - delta*x*b(x)
+			t[0] = GF::mul(gamma, lambda[0]);
+
+			for ( unsigned i = 1; i <= NK; ++i )
+				t[i] = GF::mul(gamma, lambda[i]) ^ GF::mul(delta, b[i - 1]);
+
+			if ( delta != 0 && k >= 0 )
+			{
+				// b(x) <-- lambda(x)
+				for ( unsigned i = 0; i <= NK; ++i )
+					b[i] = lambda[i];
+
+				gamma = delta;
+				k = -k - 1;
+			}
+			else
+			{
+				// b(x) <-- x*b(x)
+				for ( unsigned i = NK; i > 0; --i )
+					b[i] = b[i - 1];
+
+				b[0] = 0;
+				++k;
+			}
+
+			for ( unsigned i = 0; i <= NK; ++i )
+				lambda[i] = t[i];
+		}
+
+		unsigned degLambda = 0;
+
+		for ( unsigned i = 0; i <= NK; ++i )
+			if ( lambda[i] != 0 )
+				degLambda = i;
+
+		if ( degLambda == 0 || degLambda > T )
+			return -1;
+
+		// omega(x) = s(x)*lambda(x) mod x**NK
+		Elem omega[NK];
+		unsigned degOmega = 0;
+
+		for ( unsigned i = 0; i < NK; ++i )
+		{
+			Elem tmp = 0;
+
+			for ( unsigned j = 0; j <= i && j <= degLambda; ++j )
+				tmp ^= GF::mul(syn[i - j], lambda[j]);
+
+			omega[i] = tmp;
+
+			if ( tmp != 0 )
+				degOmega = i;
+		}
+
+		// Chien registers in index form, position 0: X**-j = 1
+		unsigned lreg[NK + 1], oreg[NK];
+
+		for ( unsigned j = 0; j <= degLambda; ++j )
+			lreg[j] = GF::log(lambda[j]);
+
+		for ( unsigned j = 0; j <= degOmega; ++j )
+			oreg[j] = GF::log(omega[j]);
+
+		unsigned pos[NK];
+		Elem err[NK];
+		unsigned count = 0;
+
+		for ( unsigned loc = 0; loc < N && count < degLambda; ++loc )
+		{
+			if ( loc == K )
+			{
+				// jump from K to FullK: multiply by alpha**(-j*(FullK-K))
+				for ( unsigned j = 1; j <= degLambda; ++j )
+					if ( lreg[j] != GF::LogZero )
+						lreg[j] = (lreg[j] + j * (N - FullK + K)) % N;
+
+				for ( unsigned j = 1; j <= degOmega; ++j )
+					if ( oreg[j] != GF::LogZero )
+						oreg[j] = (oreg[j] + j * (N - FullK + K)) % N;
+
+				loc = FullK;
+			}
+
+			// sum = lambda(X**-1), odd = X**-1 * lambda'(X**-1)
+			Elem sum = lambda[0];
+			Elem odd = 0;
+
+			for ( unsigned j = 1; j <= degLambda; ++j )
+			{
+				Elem v = GF::exp(lreg[j]);
+				sum ^= v;
+
+				if ( j & 1 )
+					odd ^= v;
+			}
+
+			if ( sum == 0 )
+			{
+				if ( (loc >= K && loc < FullK) || odd == 0 )
+					return -1;
+
+				// omega(X**-1)
+				Elem num = omega[0];
+
+				for ( unsigned j = 1; j <= degOmega; ++j )
+					num ^= GF::exp(oreg[j]);
+
+				// e = omega(X**-1) / lambda'(X**-1)
+				//   = omega(X**-1) / (X * odd), X = alpha**loc
+				err[count] = GF::mulExp(GF::div(num, odd), N - loc);
+				pos[count++] = loc;
+			}
+
+			// step to the next position: multiply term j by alpha**-j
+			for ( unsigned j = 1; j <= degLambda; ++j )
+				if ( lreg[j] != GF::LogZero )
+				{
+					lreg[j] += N - j;
+
+					if ( lreg[j] >= N )
+						lreg[j] -= N;
+				}
+
+			for ( unsigned j = 1; j <= degOmega; ++j )
+				if ( oreg[j] != GF::LogZero )
+				{
+					oreg[j] += N - j;
+
+					if ( oreg[j] >= N )
+						oreg[j] -= N;
+				}
+		}
+
+		if ( count != degLambda )
+			return -1;
+
+		// apply the errors, data bytes can't take a wider error value
+		for ( unsigned i = 0; i < count; ++i )
+			if ( pos[i] < K && (err[i] >> 8) != 0 )
+				return -1;
+
+		for ( unsigned i = 0; i < count; ++i )
+			if ( pos[i] < K )
+				data[pos[i]] ^= uint8_t(err[i]);
+
+		return count;
+	}
+
+private:
+	static constexpr unsigned Words = RsTables<GF, T, K>::Words;
+	static constexpr unsigned TopWord = (NK - 1) / 4;
+	static constexpr unsigned TopShift = 16 * ((NK - 1) % 4);
+
+	static constexpr RsTables<GF, T, K> tables_ = RsTables<GF, T, K>();
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <atomic>
+#include "stats.h"
+
+using namespace std;
+
+bool statsEnabled(false);
+
+namespace {
+
+struct PhaseTotals
+{
+	atomic<uint64_t> calls;
+	atomic<uint64_t> wall;	// ns
+	atomic<uint64_t> cpu;
+};
+
+const char *const phaseNames[PhaseCount] =
+{
+	"validate", "read", "ecc", "crc", "parse", "encode", "erase", "program"
+};
+
+const char *const counterNames[CounterCount] =
+{
+	"blocks_clean", "blocks_corrected", "blocks_failed", "symbols_corrected",
+	"driver_corrected", "driver_failed", "bytes_read", "bytes_written"
+};
+
+PhaseTotals phases[PhaseCount];
+atomic<uint64_t> counters[CounterCount];
+uint64_t startWall;
+uint64_t startCpu;	// us, of the process
+string statsFile;
+string context;
+
+uint64_t clockNs(clockid_t clock)
+{
+	timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t cpuUs()
+{
+	rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+			+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// one line, times in microseconds
+void writeStats(ostream &out)
+{
+	rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	out << "{" << context << "\"wall_us\":" << (clockNs(CLOCK_MONOTONIC) - startWall) / 1000
+			<< ",\"cpu_us\":" << cpuUs() - startCpu
+			<< ",\"peak_rss_kb\":" << usage.ru_maxrss << ",\"phases\":{";
+
+	for ( int i = 0; i < PhaseCount; ++i )
+	{
+		out << (i ? "," : "") << "\"" << phaseNames[i] << "\":{\"calls\":" << phases[i].calls
+				<< ",\"wall_us\":" << phases[i].wall / 1000
+				<< ",\"cpu_us\":" << phases[i].cpu / 1000 << "}";
+	}
+
+	out << "}";
+
+	for ( int i = 0; i < CounterCount; ++i )
+		out << ",\"" << counterNames[i] << "\":" << counters[i];
+
+	out << "}" << endl;
+}
+
+// at exit, so that a run that fails reports too
+void reportStats()
+{
+	if ( statsFile.empty() )
+	{
+		writeStats(cerr);
+		return;
+	}
+
+	ofstream out(statsFile.c_str());
+
+	writeStats(out);
+
+	if ( ! out.flush() )
+		cerr << "reportStats(): unable to write " << statsFile << endl;
+}
+
+}; // anonymous namespace
+
+void enableStats(const string &file)
+{
+	if ( ! statsEnabled )
+		atexit(reportStats);
+
+	statsEnabled = true;
+	statsFile = file;
+	startWall = clockNs(CLOCK_MONOTONIC);
+	startCpu = cpuUs();
+}
+
+void statsContext(const string &json)
+{
+	context = json.empty() ? json : json + ",";
+}
+
+void addCount(Counter counter, uint64_t n)
+{
+	counters[counter] += n;
+}
+
+void PhaseTimer::start()
+{
+	if ( clocks_ & Wall )
+		wall_ = clockNs(CLOCK_MONOTONIC);
+
+	if ( clocks_ & Cpu )
+		cpu_ = clockNs(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void PhaseTimer::stop()
+{
+	PhaseTotals &t(phases[phase_]);
+
+	if ( clocks_ & Cpu )
+		t.cpu += clockNs(CLOCK_THREAD_CPUTIME_ID) - cpu_;
+
+	if ( clocks_ & Wall )
+	{
+		t.wall += clockNs(CLOCK_MONOTONIC) - wall_;
+		++t.calls;
+	}
+}
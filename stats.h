@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+ * Where a run spends its time (--stats): wall and cpu time per phase plus
+ * counters, reported as one JSON object when the process exits.
+ *
+ * Phases don't nest, so their wall times add up to at most the wall time
+ * of the run (except for --fleet, where every dump adds its own).  The cpu
+ * time of a phase is that of all threads working on it.  Nothing is
+ * measured unless enableStats() was called.
+ */
+enum Phase
+{
+	ValidatePhase,	// finding, opening and checking the device
+	ReadPhase,	// raw nand reads
+	EccPhase,	// RS ECC check and correction
+	CrcPhase,
+	ParsePhase,	// finding and loading the variables
+	EncodePhase,	// building the env and its ECC
+	ErasePhase,
+	ProgramPhase,
+	PhaseCount
+};
+
+enum Counter
+{
+	CleanBlocks,		// ECC blocks without errors
+	CorrectedBlocks,
+	FailedBlocks,
+	CorrectedSymbols,
+	DriverCorrected,	// bitflips the nand driver's ECC corrected
+	DriverFailed,
+	BytesRead,		// from the nand, raw pages with oob
+	BytesWritten,
+	CounterCount
+};
+
+extern bool statsEnabled;
+
+// measure from now on, the report goes to 'file' (stderr if empty) at exit
+void enableStats(const std::string &file);
+
+// JSON members that describe the run ("name":value,...), first in the report
+void statsContext(const std::string &json);
+
+void addCount(Counter counter, uint64_t n);
+
+inline void statsCount(Counter counter, uint64_t n)
+{
+	if ( statsEnabled )
+		addCount(counter, n);
+}
+
+// adds the time from its construction to its destruction to a phase
+class PhaseTimer
+{
+public:
+	// a phase spread over a WorkPool gets a Wall timer around run() and a
+	// Cpu timer in every piece of work
+	enum Clocks { Wall = 1, Cpu = 2, Both = Wall | Cpu };
+
+	explicit PhaseTimer(Phase phase, Clocks clocks = Both)
+		: phase_(phase), clocks_(clocks), wall_(0), cpu_(0)
+	{
+		if ( statsEnabled )
+			start();
+	}
+
+	~PhaseTimer()
+	{
+		if ( statsEnabled )
+			stop();
+	}
+
+private:
+	PhaseTimer(const PhaseTimer &);
+	PhaseTimer &operator=(const PhaseTimer &);
+
+	void start();
+	void stop();
+
+	Phase phase_;
+	Clocks clocks_;
+	uint64_t wall_;		// ns at the start
+	uint64_t cpu_;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include "workpool.h"
+
+using namespace std;
+
+namespace {
+
+// the unclaimed part of a worker's items is [next, end)
+struct alignas(64) Range
+{
+	atomic<size_t> next;
+	size_t end;
+};
+
+void work(vector<Range> &ranges, unsigned self, size_t grain,
+		const function<void(size_t, size_t)> &fn)
+{
+	const unsigned n = ranges.size();
+
+	// own range first, then steal from the others in turn
+	for ( unsigned i = 0; i < n; ++i )
+	{
+		Range &r(ranges[(self + i) % n]);
+
+		for ( ;; )
+		{
+			size_t begin = r.next.fetch_add(grain, memory_order_relaxed);
+
+			if ( begin >= r.end )
+				break;
+
+			fn(begin, min(begin + grain, r.end));
+		}
+	}
+}
+
+/*
+ * The threads of every WorkPool: started by the first run that needs them,
+ * parked between runs.  It is never destroyed, an exit() while a run is
+ * going on must not wait for it.
+ */
+class Threads
+{
+public:
+	static Threads &get()
+	{
+		static Threads *threads = new Threads;
+		return *threads;
+	}
+
+	// fn(1) ... fn(n) on parked threads, fn(0) on the caller
+	void run(unsigned n, const function<void(unsigned)> &fn);
+
+private:
+	Threads() : started_(0), job_(0), wanted_(0), generation_(0), pending_(0) {}
+
+	void loop(unsigned self, unsigned generation);
+
+	mutex runLock_;		// one run at a time
+	mutex lock_;
+	condition_variable wake_;
+	condition_variable done_;
+	unsigned started_;
+	const function<void(unsigned)> *job_;
+	unsigned wanted_;	// threads 1..wanted_ take part
+	unsigned generation_;	// of the current run
+	unsigned pending_;	// threads still working on it
+};
+
+// a thread in a run: a nested run can't wait for the threads
+thread_local bool inRun;
+
+void Threads::run(unsigned n, const function<void(unsigned)> &fn)
+{
+	lock_guard<mutex> running(runLock_);
+
+	{
+		lock_guard<mutex> l(lock_);
+
+		for ( ; started_ < n; ++started_ )
+			thread(&Threads::loop, this, started_ + 1, generation_).detach();
+
+		job_ = &fn;
+		wanted_ = n;
+		pending_ = n;
+		++generation_;
+	}
+
+	wake_.notify_all();
+	inRun = true;
+	fn(0);
+	inRun = false;
+
+	unique_lock<mutex> l(lock_);
+	done_.wait(l, [&] { return pending_ == 0; });
+}
+
+void Threads::loop(unsigned self, unsigned generation)
+{
+	inRun = true;
+	unique_lock<mutex> l(lock_);
+
+	for ( ;; )
+	{
+		wake_.wait(l, [&] { return generation_ != generation; });
+		generation = generation_;
+
+		if ( self > wanted_ )
+			continue;
+
+		l.unlock();
+		(*job_)(self);
+		l.lock();
+
+		if ( --pending_ == 0 )
+			done_.notify_one();
+	}
+}
+
+}; // anonymous namespace
+
+WorkPool::WorkPool(unsigned jobs)
+	: jobs_(jobs)
+{
+	if ( jobs_ == 0 )
+		jobs_ = thread::hardware_concurrency();
+
+	if ( jobs_ == 0 )
+		jobs_ = 1;
+}
+
+void WorkPool::run(size_t count, size_t grain,
+		const function<void(size_t, size_t)> &fn) const
+{
+	if ( grain == 0 )
+		grain = 1;
+
+	size_t grains = (count + grain - 1) / grain;
+	unsigned workers = jobs_ < grains ? jobs_ : grains;
+
+	if ( workers <= 1 || inRun )
+	{
+		if ( count )
+			fn(0, count);
+
+		return;
+	}
+
+	// whole grains per worker, so only the last range has a short tail
+	vector<Range> ranges(workers);
+
+	for ( unsigned w = 0; w < workers; ++w )
+	{
+		ranges[w].next = min(grains * w / workers * grain, count);
+		ranges[w].end = min(grains * (w + 1) / workers * grain, count);
+	}
+
+	Threads::get().run(workers - 1, [&](unsigned w) { work(ranges, w, grain, fn); });
+}
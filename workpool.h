@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2011 Kelly Anderson <cbxbiker61@gmail.com>
+ *
+ * Read COPYING file distributed with this file for LICENSING information.
+ */
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stddef.h>
+#include <functional>
+
+/*
+ * Small worker pool for splitting independent items (ECC blocks) across
+ * cores.
+ *
+ * run() hands every worker a contiguous range of the items, a worker takes
+ * 'grain' items at a time from the front of its own range and, once that is
+ * empty, steals grains from the ranges of the other workers.  The calling
+ * thread is one of the workers, run() returns when all items are done.
+ *
+ * The worker threads are shared by all WorkPool objects: the first run()
+ * that needs them starts them and they stay parked for the next one, so a
+ * run costs a wakeup instead of a thread start.  Runs from different
+ * threads take turns, a run() from inside a worker does all its items on
+ * that worker.
+ */
+class WorkPool
+{
+public:
+	// jobs == 0: one worker per cpu
+	explicit WorkPool(unsigned jobs = 0);
+
+	unsigned jobs() const { return jobs_; }
+
+	// call fn(begin, end) for disjoint pieces of [0, count), 'grain' items
+	// each (the last one may be shorter); with one worker fn gets it all
+	void run(size_t count, size_t grain,
+			const std::function<void(size_t, size_t)> &fn) const;
+
+private:
+	unsigned jobs_;
+};
+
+#endif